@@ -54,31 +54,17 @@ void simple_attitude_init(void) {
 
 void home_direction_init(void) {
   home_direction.state     = 1;
-  home_direction.num_verts = 24;
+  home_direction.num_verts = 7;
   home_direction.x0        = osd_params.HomeDirection_posX + 10;
   home_direction.y0        = osd_params.HomeDirection_posY + 10;
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[0]), -2, -2);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[1]), -2, 8);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[2]), -1, -2);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[3]), -1, 8);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[4]), 0, -2);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[5]), 0, 8);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[6]), 1, -2);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[7]), 1, 8);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[8]), 2, -2);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[9]), 2, 8);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[10]), -5, -3);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[11]), 5, -3);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[12]), -4, -4);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[13]), 4, -4);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[14]), -3, -5);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[15]), 3, -5);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[16]), -2, -6);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[17]), 2, -6);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[18]), -1, -7);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[19]), 1, -7);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[20]), 0, -8);
-  VECTOR2D_INITXYZ(&(home_direction.vlist_local[21]), 0, -8);
+  // filled arrow, bottom row of a filled polygon is not drawn
+  VECTOR2D_INITXYZ(&(home_direction.vlist_local[0]), 0, -8);
+  VECTOR2D_INITXYZ(&(home_direction.vlist_local[1]), 6, -2);
+  VECTOR2D_INITXYZ(&(home_direction.vlist_local[2]), 2, -2);
+  VECTOR2D_INITXYZ(&(home_direction.vlist_local[3]), 2, 9);
+  VECTOR2D_INITXYZ(&(home_direction.vlist_local[4]), -2, 9);
+  VECTOR2D_INITXYZ(&(home_direction.vlist_local[5]), -2, -2);
+  VECTOR2D_INITXYZ(&(home_direction.vlist_local[6]), -6, -2);
 
   home_direction_outline.state     = 1;
   home_direction_outline.num_verts = 14;
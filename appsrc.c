@@ -29,6 +29,9 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <glib.h>
 
 #include "graphengine.h"
@@ -36,6 +39,90 @@
 // For gstreamer < 1.18
 GstClockTime gst_element_get_current_running_time (GstElement * element);
 
+// Benchmark statistics are printed every BENCH_FRAMES video frames
+#define BENCH_FRAMES 300
+
+// With -T OSD frames for appsrc are rendered ahead by a separate thread,
+// so the streaming thread doesn't wait for rendering. A frame is rendered
+// again when taken or after OSD_RENDER_PERIOD_US. Off by default until
+// its latency is measured against rendering in need-data.
+#define OSD_READY_FRAMES 2
+#define OSD_RENDER_PERIOD_US (G_USEC_PER_SEC / 60)
+
+int osd_render_thread = 0;
+
+static struct
+{
+    GMutex mutex;
+    GCond cond;
+    GstBuffer *frames[OSD_READY_FRAMES];    // oldest first
+    gint64 render_time[OSD_READY_FRAMES];
+    int count;
+    GstBuffer *last;                        // last taken frame, reused when none is ready
+    gint64 last_time;
+} osd_ready;
+
+// Block time is how long the streaming thread spent getting the OSD frame,
+// age is time from start of the frame render to its push (telemetry latency).
+// Jitter is the standard deviation of the age.
+static struct
+{
+    pthread_mutex_t mutex;
+    gint64 start_time;
+    guint frames;
+    guint renders;
+    gint64 block_time;
+    gint64 block_max;
+    gint64 age_time;
+    double age_sq;
+} bench = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static void bench_render_done(gint64 start_time, gint64 render_time)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 block = now - start_time;
+    gint64 age = now - render_time;
+
+    pthread_mutex_lock(&bench.mutex);
+    bench.renders++;
+    bench.block_time += block;
+    bench.block_max = MAX(bench.block_max, block);
+    bench.age_time += age;
+    bench.age_sq += (double)age * age;
+    pthread_mutex_unlock(&bench.mutex);
+}
+
+static GstPadProbeReturn cb_bench_frame (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    gint64 now = g_get_monotonic_time();
+
+    pthread_mutex_lock(&bench.mutex);
+    if (bench.start_time == 0)
+    {
+        bench.start_time = now;
+    }
+    else if (++bench.frames == BENCH_FRAMES)
+    {
+        guint n = MAX(bench.renders, 1);
+        double age_avg = (double)bench.age_time / n;
+
+        printf("bench %s%s: %.1f fps, osd block avg %.3f ms, max %.3f ms, age avg %.3f ms, jitter %.3f ms, %u frames\n",
+               osd_output == OSD_OUTPUT_COMPOSITION ? "composition" : "mixer",
+               osd_output == OSD_OUTPUT_MIXER && osd_render_thread ? " threaded" : "",
+               bench.frames * 1e6 / (now - bench.start_time),
+               bench.block_time / 1e3 / n, bench.block_max / 1e3,
+               age_avg / 1e3, sqrt(MAX(bench.age_sq / n - age_avg * age_avg, 0)) / 1e3,
+               bench.renders);
+
+        bench.start_time = now;
+        bench.frames = bench.renders = 0;
+        bench.block_time = bench.block_max = bench.age_time = 0;
+        bench.age_sq = 0;
+    }
+    pthread_mutex_unlock(&bench.mutex);
+
+    return GST_PAD_PROBE_OK;
+}
 
 static gboolean
 on_message (GstBus * bus, GstMessage * message, gpointer user_data)
@@ -88,13 +175,88 @@ on_message (GstBus * bus, GstMessage * message, gpointer user_data)
     return TRUE;
 }
 
+static void* render_thread(void *arg)
+{
+    while (1)
+    {
+        gint64 render_time = g_get_monotonic_time();
+
+        GstBuffer *buffer = render();
+
+        g_mutex_lock(&osd_ready.mutex);
+
+        // Queue keeps the newest frames
+        if (osd_ready.count == OSD_READY_FRAMES)
+        {
+            gst_buffer_unref(osd_ready.frames[0]);
+            memmove(osd_ready.frames, osd_ready.frames + 1, sizeof(osd_ready.frames[0]) * (OSD_READY_FRAMES - 1));
+            memmove(osd_ready.render_time, osd_ready.render_time + 1, sizeof(osd_ready.render_time[0]) * (OSD_READY_FRAMES - 1));
+            osd_ready.count--;
+        }
+        osd_ready.frames[osd_ready.count] = buffer;
+        osd_ready.render_time[osd_ready.count] = render_time;
+        osd_ready.count++;
+        g_cond_broadcast(&osd_ready.cond);
+
+        // Wait until the frame is taken or gets old
+        gint64 deadline = render_time + OSD_RENDER_PERIOD_US;
+        while (osd_ready.count > 0 && g_cond_wait_until(&osd_ready.cond, &osd_ready.mutex, deadline));
+
+        g_mutex_unlock(&osd_ready.mutex);
+    }
+    return NULL;
+}
+
+// Newest frame rendered by render_thread. Never waits for rendering.
+static GstBuffer* take_ready_frame(gint64 *render_time)
+{
+    GstBuffer *buffer;
+
+    g_mutex_lock(&osd_ready.mutex);
+    if (osd_ready.count > 0)
+    {
+        for (int i = 0; i < osd_ready.count - 1; i++)
+        {
+            gst_buffer_unref(osd_ready.frames[i]);
+        }
+
+        if (osd_ready.last != NULL)
+        {
+            gst_buffer_unref(osd_ready.last);
+        }
+        osd_ready.last = osd_ready.frames[osd_ready.count - 1];
+        osd_ready.last_time = osd_ready.render_time[osd_ready.count - 1];
+        osd_ready.count = 0;
+        g_cond_broadcast(&osd_ready.cond);
+    }
+
+    // Previous frame is shown again if the render thread is late.
+    // The buffer stays shared with osd_ready.last.
+    *render_time = osd_ready.last_time;
+    buffer = gst_buffer_ref(osd_ready.last);
+    g_mutex_unlock(&osd_ready.mutex);
+
+    return buffer;
+}
+
 static void cb_need_data (GstElement *appsrc, guint unused_size, gpointer user_data)
 {
     GMainLoop *loop = (GMainLoop *) user_data;
+    gint64 start_time = g_get_monotonic_time();
+    gint64 render_time = start_time;
+    GstBuffer *buffer;
+
+    if (osd_render_thread)
+    {
+        buffer = take_ready_frame(&render_time);
+    } else {
+        buffer = render();
+    }
+
+    bench_render_done(start_time, render_time);
 
-    pthread_mutex_lock(&video_mutex);
-    GstBuffer *buffer = render();
-    pthread_mutex_unlock(&video_mutex);
+    // Ready frames are shared, timestamps go to a copy of the metadata
+    buffer = gst_buffer_make_writable(buffer);
 
     GST_BUFFER_PTS (buffer) = gst_element_get_current_running_time(appsrc);
 
@@ -117,8 +279,44 @@ static void cb_need_data (GstElement *appsrc, guint unused_size, gpointer user_d
     }
 }
 
-static const char* select_osd_render(osd_render_t osd_render)
+// Attach OSD to the decoded frame as overlay composition meta
+static GstPadProbeReturn cb_attach_osd (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstCaps *caps = gst_pad_get_current_caps (pad);
+    gint64 start_time = g_get_monotonic_time();
+    GstVideoInfo vinfo;
+
+    if (caps != NULL && gst_video_info_from_caps (&vinfo, caps))
+    {
+        render_set_output_size(GST_VIDEO_INFO_WIDTH (&vinfo), GST_VIDEO_INFO_HEIGHT (&vinfo));
+    }
+    GstVideoOverlayComposition *comp = render();
+
+    if (caps != NULL)
+    {
+        gst_caps_unref (caps);
+    }
+
+    if (comp != NULL)
+    {
+        buffer = gst_buffer_make_writable (buffer);
+        gst_buffer_add_video_overlay_composition_meta (buffer, comp);
+        gst_video_overlay_composition_unref (comp);
+        GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    }
+
+    bench_render_done(start_time, start_time);
+    return GST_PAD_PROBE_OK;
+}
+
+static const char* select_osd_render(osd_render_t osd_render, int bench_mode)
 {
+    if (bench_mode)
+    {
+        return "fakesink name=video_sink";
+    }
+
     switch(osd_render)
     {
     case OSD_RENDER_XV:
@@ -139,8 +337,31 @@ static const char* select_osd_render(osd_render_t osd_render)
     }
 }
 
+// Sinks for overlay composition mode. glimagesink blends the meta itself,
+// for others gloverlaycompositor uploads and blends only the OSD rectangles.
+static const char* select_composition_render(osd_render_t osd_render, int bench_mode)
+{
+    if (bench_mode)
+    {
+        return "glupload ! gloverlaycompositor ! fakesink name=video_sink";
+    }
+
+    switch(osd_render)
+    {
+    case OSD_RENDER_XV:
+        return "glupload ! gloverlaycompositor ! glcolorconvert ! gldownload ! xvimagesink";
+
+    case OSD_RENDER_GL:
+        return "glimagesink";
+
+    case OSD_RENDER_AUTO:
+    default:
+        return "glupload ! gloverlaycompositor ! glcolorconvert ! gldownload ! autovideosink";
+    }
+}
+
 
-int gst_main(int rtp_port, char *codec, int rtp_jitter, osd_render_t osd_render, int screen_width, char *rtsp_src)
+int gst_main(int rtp_port, char *codec, int rtp_jitter, osd_render_t osd_render, int screen_width, char *rtsp_src, int bench_mode)
 {
     int screen_height = screen_width * 9 / 16;
 
@@ -157,9 +378,16 @@ int gst_main(int rtp_port, char *codec, int rtp_jitter, osd_render_t osd_render,
     {
         char *pipeline_str = NULL;
         char *src_str = NULL;
+        char *video_str = NULL;
         GError *error = NULL;
 
-        if(rtsp_src != NULL)
+        if(bench_mode)
+        {
+            asprintf(&video_str,
+                     "videotestsrc is-live=true ! video/x-raw,width=%d,height=%d,framerate=60/1",
+                     screen_width, screen_height);
+        }
+        else if(rtsp_src != NULL)
         {
             asprintf(&src_str,
                      "rtspsrc latency=%d location=\"%s\"", rtp_jitter, rtsp_src);
@@ -172,7 +400,7 @@ int gst_main(int rtp_port, char *codec, int rtp_jitter, osd_render_t osd_render,
         char *codecs[] = { "nv%sdec", "avdec_%s" };
         char *decoder = NULL;
 
-        for(int i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+        for(int i = 0; video_str == NULL && i < sizeof(codecs) / sizeof(codecs[0]); i++)
         {
             char *buf = NULL;
             asprintf(&buf, codecs[i], codec);
@@ -188,38 +416,56 @@ int gst_main(int rtp_port, char *codec, int rtp_jitter, osd_render_t osd_render,
             free(buf);
         }
 
-        if(decoder == NULL)
+        if(video_str == NULL)
         {
-            fprintf(stderr, "No decoder for %s was found\n", codec);
-            exit(1);
+            if(decoder == NULL)
+            {
+                fprintf(stderr, "No decoder for %s was found\n", codec);
+                exit(1);
+            }
+
+            asprintf(&video_str,
+                     "%s ! "
+                     "rtp%sdepay ! "
+                     "%sparse config-interval=1 disable-passthrough=true ! "
+                     "%s qos=false",
+                     src_str, codec, codec, decoder);
         }
 
-        asprintf(&pipeline_str,
-                 "%s ! "
-                 "rtp%sdepay ! "
-                 "%sparse config-interval=1 disable-passthrough=true ! "
-                 "%s qos=false ! "
-                 "queue leaky=downstream max-size-buffers=1 max-size-bytes=0 ! "
-                 "glupload ! glcolorconvert ! "
-                 "glvideomixerelement emit-signals=true start-time-selection=1 name=osd_mixer "
-                 "sink_0::emit-signals=true sink_0::width=%d sink_0::height=%d sink_0::zorder=-2 "
-                 "sink_1::emit-signals=true sink_1::width=%d sink_1::height=%d sink_1::zorder=0 "
+        if(osd_output == OSD_OUTPUT_COMPOSITION)
+        {
+            asprintf(&pipeline_str,
+                     "%s ! "
+                     "queue leaky=downstream max-size-buffers=1 max-size-bytes=0 ! "
+                     "identity name=osd_attach ! "
+                     "%s sync=true",
+                     video_str, select_composition_render(osd_render, bench_mode));
+        } else {
+            asprintf(&pipeline_str,
+                     "%s ! "
+                     "queue leaky=downstream max-size-buffers=1 max-size-bytes=0 ! "
+                     "glupload ! glcolorconvert ! "
+                     "glvideomixerelement emit-signals=true start-time-selection=1 name=osd_mixer "
+                     "sink_0::emit-signals=true sink_0::width=%d sink_0::height=%d sink_0::zorder=-2 "
+                     "sink_1::emit-signals=true sink_1::width=%d sink_1::height=%d sink_1::zorder=0 "
 #if LOCAL_CAMERA_SUPPORT
-                 "sink_2::emit-signals=true sink_2::width=640 sink_2::height=360 sink_2::zorder=-1 "
+                     "sink_2::emit-signals=true sink_2::width=640 sink_2::height=360 sink_2::zorder=-1 "
 #endif
-                 "! %s sync=true "
-                 "appsrc name=osd_src stream-type=0 format=time min-latency=0 ! "
-                 "video/x-raw,format=RGBA,width=%d,height=%d,framerate=0/1 ! glupload ! glcolorconvert ! osd_mixer. "
+                     "! %s sync=true "
+                     "appsrc name=osd_src stream-type=0 format=time min-latency=0 ! "
+                     "video/x-raw,format=RGBA,width=%d,height=%d,framerate=0/1 ! glupload ! glcolorconvert ! osd_mixer. "
 #if LOCAL_CAMERA_SUPPORT
-                 "v4l2src device=/dev/video2 ! video/x-raw,width=640,height=360,framerate=30/1 ! queue ! glupload ! glcolorconvert ! osd_mixer."
+                     "v4l2src device=/dev/video2 ! video/x-raw,width=640,height=360,framerate=30/1 ! queue ! glupload ! glcolorconvert ! osd_mixer."
 #endif
-                 ,
-                 src_str, codec, codec, decoder,
-                 screen_width, screen_height, screen_width, screen_height,
-                 select_osd_render(osd_render),
-                 GRAPHICS_WIDTH, GRAPHICS_HEIGHT);
+                     ,
+                     video_str,
+                     screen_width, screen_height, screen_width, screen_height,
+                     select_osd_render(osd_render, bench_mode),
+                     osd_width, osd_height);
+        }
 
         free(src_str);
+        free(video_str);
         free(decoder);
 
         printf("GST pipeline: %s\n", pipeline_str);
@@ -238,8 +484,45 @@ int gst_main(int rtp_port, char *codec, int rtp_jitter, osd_render_t osd_render,
     g_assert(pipeline);
 
     /* setup */
-    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "osd_src");
-    g_signal_connect (appsrc, "need-data", G_CALLBACK (cb_need_data), loop);
+    if (osd_output == OSD_OUTPUT_COMPOSITION)
+    {
+        GstElement *attach = gst_bin_get_by_name(GST_BIN(pipeline), "osd_attach");
+        GstPad *pad = gst_element_get_static_pad(attach, "src");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb_attach_osd, NULL, NULL);
+        gst_object_unref(pad);
+        gst_object_unref(attach);
+    } else {
+        GstElement *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "osd_src");
+        g_signal_connect (appsrc, "need-data", G_CALLBACK (cb_need_data), loop);
+
+        if (osd_render_thread)
+        {
+            pthread_t tid;
+            gint64 render_time;
+
+            g_mutex_init(&osd_ready.mutex);
+            g_cond_init(&osd_ready.cond);
+            pthread_create(&tid, NULL, render_thread, NULL);
+
+            // Wait for the first frame
+            g_mutex_lock(&osd_ready.mutex);
+            while (osd_ready.count == 0)
+            {
+                g_cond_wait(&osd_ready.cond, &osd_ready.mutex);
+            }
+            g_mutex_unlock(&osd_ready.mutex);
+            gst_buffer_unref(take_ready_frame(&render_time));
+        }
+    }
+
+    if (bench_mode)
+    {
+        GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "video_sink");
+        GstPad *pad = gst_element_get_static_pad(sink, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb_bench_frame, NULL, NULL);
+        gst_object_unref(pad);
+        gst_object_unref(sink);
+    }
 
     // Set message handler
     {
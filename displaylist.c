@@ -0,0 +1,492 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * Display lists: write_* primitives called while dl_recording is set append
+ * compact commands instead of drawing. A recorded frame can be compared with
+ * the previous one, replayed into any render target (or a band of it from
+ * another thread) and saved to a file for offline profiling.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+#include "osdrender.h"
+#include "graphengine.h"
+#include "displaylist.h"
+#include "fonts.h"
+
+#define DL_FILE_MAGIC 0x4c44534fu  // "OSDL"
+#define DL_FILE_MAX_SIZE (16 << 20)
+#define DL_FILE_MAX_COORD 65535     // keeps coordinate math of primitives in int range
+
+// Number of arguments of each command type
+static const uint8_t dl_argc[DL_MAX_TYPE] =
+{
+    [DL_PIXEL] = 4,
+    [DL_HLINE] = 5,
+    [DL_HLINE_OUTLINED] = 8,
+    [DL_VLINE] = 5,
+    [DL_VLINE_OUTLINED] = 8,
+    [DL_FILLED_RECT] = 6,
+    [DL_CIRCLE] = 8,
+    [DL_LINE] = 6,
+    [DL_LINE_OUTLINED] = 6,
+    [DL_LINE_OUTLINED_DASHED] = 7,
+    [DL_CHAR16] = 5,
+    [DL_CHAR] = 6,
+    [DL_STRING] = 9,
+    [DL_POLYGON] = 3,
+    [DL_PUSH_CLIP] = 4,
+    [DL_POP_CLIP] = 0,
+    [DL_TEXT_TILE] = 0,
+};
+
+__thread struct display_list *dl_recording = NULL;
+FILE *dl_dump_file = NULL;
+
+void dl_reset(struct display_list *dl)
+{
+    dl->size = 0;
+    dl->count = 0;
+}
+
+static int16_t clamp_row(int y)
+{
+    return y < INT16_MIN ? INT16_MIN : y > INT16_MAX ? INT16_MAX : y;
+}
+
+// Make room for a command of given size at the end of the list
+static struct dl_cmd* dl_reserve(struct display_list *dl, size_t size)
+{
+    if (dl->size + size > dl->capacity)
+    {
+        dl->capacity = dl->capacity * 2 > dl->size + size ? dl->capacity * 2 : dl->size + size + 16384;
+        dl->data = realloc(dl->data, dl->capacity);
+        assert(dl->data != NULL);
+    }
+    return (struct dl_cmd*)(dl->data + dl->size);
+}
+
+/**
+ * dl_append: add command to the display list.
+ *
+ * @param       dl              display list
+ * @param       type            command type
+ * @param       y0, y1          rows touched by the command
+ * @param       payload         data stored after arguments, may be NULL
+ * @param       payload_size    payload size in bytes
+ * @param       argc            number of integer arguments that follow
+ */
+void dl_append(struct display_list *dl, int type, int y0, int y1, const void *payload, int payload_size, int argc, ...)
+{
+    va_list ap;
+    // keep commands 4 byte aligned
+    size_t size = (sizeof(struct dl_cmd) + argc * sizeof(int32_t) + payload_size + 3) & ~3;
+
+    assert(size <= UINT16_MAX && argc <= UINT8_MAX);
+
+    struct dl_cmd *cmd = dl_reserve(dl, size);
+
+    cmd->type = type;
+    cmd->argc = argc;
+    cmd->size = size;
+    cmd->y0 = clamp_row(y0);
+    cmd->y1 = clamp_row(y1);
+
+    va_start(ap, argc);
+    for (int i = 0; i < argc; i++)
+    {
+        cmd->args[i] = va_arg(ap, int);
+    }
+    va_end(ap);
+
+    if (payload_size > 0)
+    {
+        memcpy(cmd->args + argc, payload, payload_size);
+    }
+    // padding is zeroed to make lists comparable with memcmp
+    memset((uint8_t*)(cmd->args + argc) + payload_size, '\0', size - sizeof(struct dl_cmd) - argc * sizeof(int32_t) - payload_size);
+
+    dl->size += size;
+    dl->count++;
+}
+
+/**
+ * dl_equal: check if two display lists draw the same picture.
+ * Text tiles are compared by cache generation, so a changed tile makes
+ * lists different.
+ */
+int dl_equal(const struct display_list *a, const struct display_list *b)
+{
+    return a->size == b->size && memcmp(a->data, b->data, a->size) == 0;
+}
+
+void dl_execute_cmd(const struct dl_cmd *cmd)
+{
+    const int32_t *a = cmd->args;
+
+    switch (cmd->type)
+    {
+    case DL_PIXEL:
+        write_pixel_lm(a[0], a[1], a[2], a[3]);
+        break;
+    case DL_HLINE:
+        write_hline_lm(a[0], a[1], a[2], a[3], a[4]);
+        break;
+    case DL_HLINE_OUTLINED:
+        write_hline_outlined(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+        break;
+    case DL_VLINE:
+        write_vline_lm(a[0], a[1], a[2], a[3], a[4]);
+        break;
+    case DL_VLINE_OUTLINED:
+        write_vline_outlined(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+        break;
+    case DL_FILLED_RECT:
+        write_filled_rectangle_lm(a[0], a[1], a[2], a[3], a[4], a[5]);
+        break;
+    case DL_CIRCLE:
+        write_circle_outlined(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+        break;
+    case DL_LINE:
+        write_line_lm(a[0], a[1], a[2], a[3], a[4], a[5]);
+        break;
+    case DL_LINE_OUTLINED:
+        write_line_outlined(a[0], a[1], a[2], a[3], 0, 0, a[4], a[5]);
+        break;
+    case DL_LINE_OUTLINED_DASHED:
+        write_line_outlined_dashed(a[0], a[1], a[2], a[3], 0, 0, a[4], a[5], a[6]);
+        break;
+    case DL_CHAR16:
+        write_char16(a[0], a[1], a[2], a[3], a[4]);
+        break;
+    case DL_CHAR:
+        write_char(a[0], a[1], a[2], a[3], a[4], a[5]);
+        break;
+    case DL_STRING:
+        write_color_string((char*)DL_PAYLOAD(cmd), a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]);
+        break;
+    case DL_POLYGON:
+    {
+        int vx[POLYGON_MAX_VERTICES], vy[POLYGON_MAX_VERTICES];
+        int n = a[0] < POLYGON_MAX_VERTICES ? a[0] : POLYGON_MAX_VERTICES;
+        const int32_t *v = DL_PAYLOAD(cmd);
+        for (int i = 0; i < n; i++)
+        {
+            vx[i] = v[2 * i];
+            vy[i] = v[2 * i + 1];
+        }
+        write_polygon_filled(vx, vy, n, a[1], a[2]);
+        break;
+    }
+    case DL_PUSH_CLIP:
+        push_clip_rect(a[0], a[1], a[2], a[3]);
+        break;
+    case DL_POP_CLIP:
+        pop_clip_rect();
+        break;
+    case DL_TEXT_TILE:
+    {
+        struct text_cache *tc;
+        memcpy(&tc, DL_PAYLOAD(cmd), sizeof(tc));
+        write_text_cache(tc);
+        break;
+    }
+    default:
+        assert(0);
+    }
+}
+
+/**
+ * dl_execute: draw all commands of the list into the current render target.
+ */
+void dl_execute(const struct display_list *dl)
+{
+    assert(dl_recording == NULL);
+
+    for (const struct dl_cmd *cmd = DL_FIRST(dl); cmd < DL_END(dl); cmd = DL_NEXT(cmd))
+    {
+        dl_execute_cmd(cmd);
+    }
+}
+
+/**
+ * dl_write: append display list to a file.
+ * Text tiles reference memory of this process and are saved as strings.
+ *
+ * @return      0 on success, -1 on error
+ */
+int dl_write(const struct display_list *dl, FILE *f)
+{
+    static struct display_list out;
+    uint32_t header[2];
+
+    dl_reset(&out);
+
+    for (const struct dl_cmd *cmd = DL_FIRST(dl); cmd < DL_END(dl); cmd = DL_NEXT(cmd))
+    {
+        if (cmd->type != DL_TEXT_TILE)
+        {
+            memcpy(dl_reserve(&out, cmd->size), cmd, cmd->size);
+            out.size += cmd->size;
+            out.count++;
+            continue;
+        }
+
+        struct text_cache *tc;
+        memcpy(&tc, DL_PAYLOAD(cmd), sizeof(tc));
+        dl_append(&out, DL_STRING, cmd->y0, cmd->y1, tc->str, strlen(tc->str) + 1,
+                  9, tc->x, tc->y, tc->xs, tc->ys, tc->va, tc->ha, tc->flags, tc->font, tc->color);
+    }
+
+    header[0] = DL_FILE_MAGIC;
+    header[1] = out.size;
+
+    if (fwrite(header, sizeof(header), 1, f) != 1 ||
+        (out.size > 0 && fwrite(out.data, out.size, 1, f) != 1))
+    {
+        perror("Unable to write display list");
+        return -1;
+    }
+    return 0;
+}
+
+// Arguments accepted by pack_color()
+static int dl_color_valid(int opaq, int color)
+{
+    return (opaq == 0 || opaq == 1) && color >= 0 && color <= 2;
+}
+
+// Endcaps are drawn with the stroke or fill color as opacity
+static int dl_endcaps_valid(int endcap0, int endcap1, int color)
+{
+    return endcap0 >= 0 && endcap0 <= 2 && endcap1 >= 0 && endcap1 <= 2 &&
+           (color <= 1 || (endcap0 == ENDCAP_NONE && endcap1 == ENDCAP_NONE));
+}
+
+// Check arguments and payload of a command read from a file, so that
+// replaying it can't read out of the list or trip an assertion
+static int dl_cmd_valid(const struct dl_cmd *cmd, int *clip_depth)
+{
+    const int32_t *a = cmd->args;
+    int payload_size;
+
+    // Text tiles point into memory of the recording process
+    if (cmd->type >= DL_MAX_TYPE || cmd->type == DL_TEXT_TILE || cmd->argc != dl_argc[cmd->type])
+    {
+        return 0;
+    }
+
+    payload_size = (int)cmd->size - (int)sizeof(struct dl_cmd) - cmd->argc * (int)sizeof(int32_t);
+    if (payload_size < 0)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < cmd->argc; i++)
+    {
+        if (a[i] < -DL_FILE_MAX_COORD || a[i] > DL_FILE_MAX_COORD)
+        {
+            return 0;
+        }
+    }
+
+    switch (cmd->type)
+    {
+    case DL_PIXEL:
+        return dl_color_valid(a[2], a[3]);
+    case DL_HLINE:
+    case DL_VLINE:
+        return dl_color_valid(a[4], a[3]);
+    case DL_HLINE_OUTLINED:
+    case DL_VLINE_OUTLINED:
+        return dl_color_valid(a[6], a[7]) && dl_endcaps_valid(a[3], a[4], a[7]);
+    case DL_FILLED_RECT:
+        return dl_color_valid(a[5], a[4]);
+    case DL_CIRCLE:
+        return dl_color_valid(a[6], a[7]);
+    case DL_LINE:
+        return dl_color_valid(a[4], a[5]);
+    case DL_LINE_OUTLINED:
+        return a[4] >= 0 && a[4] <= 2 && (a[5] == 0 || a[5] == 1);
+    case DL_LINE_OUTLINED_DASHED:
+        return a[5] == 0 || a[5] == 1;
+    case DL_CHAR16:
+        return a[3] >= 0 && a[3] < NUM_FONTS && a[4] >= 0 && a[4] <= 2;
+    case DL_CHAR:
+        return a[4] >= 0 && a[4] < NUM_FONTS && a[5] >= 0 && a[5] <= 2;
+    case DL_STRING:
+        return a[7] >= 0 && a[7] < NUM_FONTS && a[8] >= 0 && a[8] <= 2 &&
+               memchr(DL_PAYLOAD(cmd), '\0', payload_size) != NULL;
+    case DL_POLYGON:
+    {
+        const int32_t *v = DL_PAYLOAD(cmd);
+
+        if (!dl_color_valid(a[2], a[1]) || a[0] < 0 || a[0] > POLYGON_MAX_VERTICES ||
+            payload_size < a[0] * 2 * (int)sizeof(int32_t))
+        {
+            return 0;
+        }
+        for (int i = 0; i < a[0] * 2; i++)
+        {
+            if (v[i] < -DL_FILE_MAX_COORD || v[i] > DL_FILE_MAX_COORD)
+            {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    case DL_PUSH_CLIP:
+        return ++(*clip_depth) <= CLIP_STACK_DEPTH;
+    case DL_POP_CLIP:
+        return --(*clip_depth) >= 0;
+    }
+    return 1;
+}
+
+/**
+ * dl_read: read next display list written by dl_write.
+ *
+ * @return      1 on success, 0 at end of file, -1 on error
+ */
+int dl_read(struct display_list *dl, FILE *f)
+{
+    uint32_t header[2];
+
+    dl_reset(dl);
+
+    if (fread(header, sizeof(header), 1, f) != 1)
+    {
+        return feof(f) ? 0 : -1;
+    }
+
+    if (header[0] != DL_FILE_MAGIC)
+    {
+        fprintf(stderr, "Invalid display list file\n");
+        return -1;
+    }
+
+    if (header[1] > DL_FILE_MAX_SIZE)
+    {
+        fprintf(stderr, "Display list too large: %u bytes\n", header[1]);
+        return -1;
+    }
+
+    if (header[1] > dl->capacity)
+    {
+        dl->capacity = header[1];
+        dl->data = realloc(dl->data, dl->capacity);
+        assert(dl->data != NULL);
+    }
+
+    if (header[1] > 0 && fread(dl->data, header[1], 1, f) != 1)
+    {
+        fprintf(stderr, "Truncated display list\n");
+        return -1;
+    }
+    dl->size = header[1];
+
+    int clip_depth = 0;
+
+    for (const struct dl_cmd *cmd = DL_FIRST(dl); cmd < DL_END(dl); cmd = DL_NEXT(cmd))
+    {
+        size_t left = dl->data + dl->size - (const uint8_t*)cmd;
+
+        if (left < sizeof(struct dl_cmd) || cmd->size < sizeof(struct dl_cmd) || cmd->size > left || (cmd->size & 3) ||
+            !dl_cmd_valid(cmd, &clip_depth))
+        {
+            fprintf(stderr, "Corrupted display list\n");
+            dl_reset(dl);
+            return -1;
+        }
+        dl->count++;
+    }
+
+    if (clip_depth != 0)
+    {
+        fprintf(stderr, "Corrupted display list\n");
+        dl_reset(dl);
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * dl_replay: draw display lists of a file recorded with -L into an
+ * offscreen target of osd_width x osd_height and print time and checksum
+ * of every frame. Frames are drawn by render_threads threads, so runs with
+ * different -t give the scaling of the render pool.
+ *
+ * @param       f       file to read lists from
+ * @return      0 on success, -1 on error
+ */
+int dl_replay(FILE *f)
+{
+    size_t size = osd_width * osd_height * sizeof(pixel_t);
+    pixel_t *buf = malloc(size);
+    struct render_target rt;
+    struct display_list dl = { 0 };
+    uint64_t total_ns = 0, max_ns = 0;
+    int frames = 0;
+    int ret;
+
+    if (buf == NULL)
+    {
+        perror("Unable to allocate replay buffer");
+        return -1;
+    }
+
+    render_target_init(&rt, buf, osd_width * sizeof(pixel_t), osd_width, osd_height, OSD_PIXEL_FORMAT);
+    struct render_target *prev = set_render_target(&rt);
+
+    while ((ret = dl_read(&dl, f)) > 0)
+    {
+        uint64_t start_ns = GetSystimeNS();
+
+        render_target_clear(&rt, NULL);
+        render_execute(&dl);
+
+        uint64_t dt = GetSystimeNS() - start_ns;
+        uint32_t hash = 2166136261u;    // FNV-1a of the rasterized frame
+
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ ((uint8_t*)buf)[i]) * 16777619u;
+        }
+
+        printf("frame %d: %d commands, %llu us, checksum %08x\n", frames, dl.count, (unsigned long long)(dt / 1000), hash);
+        total_ns += dt;
+        max_ns = MAX(max_ns, dt);
+        frames++;
+    }
+
+    set_render_target(prev);
+    free(dl.data);
+    free(buf);
+
+    if (ret < 0)
+    {
+        return -1;
+    }
+
+    printf("%d frames, %d render threads, raster time avg %llu us, max %llu us\n", frames, render_threads,
+           (unsigned long long)(frames ? total_ns / frames / 1000 : 0), (unsigned long long)(max_ns / 1000));
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef DISPLAY_LIST_H__
+#define DISPLAY_LIST_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Display list commands, arguments are the ones of the matching write_* call
+enum
+{
+    DL_PIXEL = 0,               // x, y, opaq, color
+    DL_HLINE,                   // x0, x1, y, color, opaq
+    DL_HLINE_OUTLINED,          // x0, x1, y, endcap0, endcap1, mode, opaq, color
+    DL_VLINE,                   // x, y0, y1, color, opaq
+    DL_VLINE_OUTLINED,          // x, y0, y1, endcap0, endcap1, mode, opaq, color
+    DL_FILLED_RECT,             // x, y, width, height, color, opaq
+    DL_CIRCLE,                  // cx, cy, r, dashp, bmode, mode, opaq, color
+    DL_LINE,                    // x0, y0, x1, y1, opaq, color
+    DL_LINE_OUTLINED,           // x0, y0, x1, y1, mode, opaq
+    DL_LINE_OUTLINED_DASHED,    // x0, y0, x1, y1, mode, opaq, dots
+    DL_CHAR16,                  // ch, x, y, font, color
+    DL_CHAR,                    // ch, x, y, flags, font, color
+    DL_STRING,                  // x, y, xs, ys, va, ha, flags, font, color + string
+    DL_POLYGON,                 // num_verts, color, opaq + x, y pairs
+    DL_PUSH_CLIP,               // x0, y0, x1, y1
+    DL_POP_CLIP,                // no arguments
+    DL_TEXT_TILE,               // cache generation + struct text_cache pointer
+    DL_MAX_TYPE
+};
+
+// Command header followed by arguments and payload
+struct dl_cmd
+{
+    uint8_t type;
+    uint8_t argc;
+    uint16_t size;              // bytes including header, arguments and payload
+    int16_t y0, y1;             // rows touched by the command
+    int32_t args[];
+};
+
+// Commands of one frame packed in a byte buffer
+struct display_list
+{
+    uint8_t *data;
+    size_t size, capacity;
+    int count;
+};
+
+#define DL_FIRST(dl)            ((const struct dl_cmd*)(dl)->data)
+#define DL_END(dl)              ((const struct dl_cmd*)((dl)->data + (dl)->size))
+#define DL_NEXT(cmd)            ((const struct dl_cmd*)((const uint8_t*)(cmd) + (cmd)->size))
+#define DL_PAYLOAD(cmd)         ((const void*)((cmd)->args + (cmd)->argc))
+
+// List the write_* primitives of the calling thread record into, NULL to draw
+extern __thread struct display_list *dl_recording;
+
+// Recorded frames are appended to this file if set
+extern FILE *dl_dump_file;
+
+void dl_reset(struct display_list *dl);
+void dl_append(struct display_list *dl, int type, int y0, int y1, const void *payload, int payload_size, int argc, ...);
+int dl_equal(const struct display_list *a, const struct display_list *b);
+
+void dl_execute_cmd(const struct dl_cmd *cmd);
+void dl_execute(const struct display_list *dl);
+
+int dl_write(const struct display_list *dl, FILE *f);
+int dl_read(struct display_list *dl, FILE *f);
+int dl_replay(FILE *f);
+
+#endif
@@ -69,10 +69,11 @@
 
 #include "graphengine.h"
 
-#define FB_WIDTH  GRAPHICS_WIDTH
-#define FB_HEIGHT GRAPHICS_HEIGHT
 #define ZPOS 7
 
+/* front, flip pending and one more to draw while the flip is pending */
+#define MODESET_BUFFERS 3
+
 /*
  * A new struct is introduced: drm_object. It stores properties of certain
  * objects (connectors, CRTC and planes) that are used in atomic modeset setup
@@ -85,6 +86,52 @@ struct drm_object {
     uint32_t id;
 };
 
+/*
+ * Plane formats the OSD can be presented in, smallest first. 16 bit formats
+ * halve scanout and copy bandwidth and still show the few palette colors.
+ * An RGBA render buffer is drawn in place, so it needs a 32 bit plane.
+ */
+
+struct modeset_format {
+    uint32_t fourcc;
+    uint32_t bpp;
+    pixel_format_t pixel_format;
+    const char *name;
+};
+
+static const struct modeset_format modeset_formats[] = {
+#ifndef OSD_RGBA_BUFFER
+    { DRM_FORMAT_ARGB1555, 16, PIXEL_FORMAT_ARGB1555, "ARGB1555" },
+    { DRM_FORMAT_ARGB4444, 16, PIXEL_FORMAT_ARGB4444, "ARGB4444" },
+#endif
+    { DRM_FORMAT_ABGR8888, 32, PIXEL_FORMAT_RGBA32, "ABGR8888" },
+};
+
+#define MODESET_FORMAT_COUNT (sizeof(modeset_formats) / sizeof(modeset_formats[0]))
+
+/*
+ * Property IDs used in atomic commits. They are resolved by name once in
+ * modeset_setup_objects(), commits don't search the property lists.
+ */
+
+struct modeset_props {
+    uint32_t conn_crtc_id;
+    uint32_t crtc_mode_id;
+    uint32_t crtc_active;
+    uint32_t plane_fb_id;
+    uint32_t plane_crtc_id;
+    uint32_t plane_src_x;
+    uint32_t plane_src_y;
+    uint32_t plane_src_w;
+    uint32_t plane_src_h;
+    uint32_t plane_crtc_x;
+    uint32_t plane_crtc_y;
+    uint32_t plane_crtc_w;
+    uint32_t plane_crtc_h;
+    uint32_t plane_zpos;
+    uint32_t plane_damage_clips;    /* 0 if the driver ignores damage */
+};
+
 struct modeset_buf {
     uint32_t width;
     uint32_t height;
@@ -93,17 +140,25 @@ struct modeset_buf {
     uint32_t handle;
     uint8_t *map;
     uint32_t fb;
+    struct damage_map stale;    /* areas that differ from the current OSD image */
+    struct damage_map drawn;    /* areas holding OSD pixels when rendered in place */
 };
 
 struct modeset_output {
     struct modeset_output *next;
 
-    unsigned int front_buf;
-    struct modeset_buf bufs[2];
+    struct modeset_buf bufs[MODESET_BUFFERS];
+    int front_buf;              /* scanned out */
+    int pending_buf;            /* committed, waiting for the flip event, or -1 */
+    int queued_buf;             /* drawn while a flip was pending, or -1 */
+    uint32_t queued_damage;     /* damage clips blob for the queued buffer */
 
     struct drm_object connector;
     struct drm_object crtc;
     struct drm_object plane;
+    struct modeset_props prop;
+    drmModeAtomicReq *flip_req;     /* reused by every page-flip commit */
+    const struct modeset_format *format;
 
     drmModeModeInfo mode;
     uint32_t mode_blob_id;
@@ -236,27 +291,31 @@ static void modeset_get_object_properties(int fd, struct drm_object *obj,
 }
 
 /*
- * set_drm_object_property() is a new function. It sets a property value to a
- * CRTC, plane or connector object.
+ * find_drm_object_property() returns the id of the property 'name' of a CRTC,
+ * plane or connector object, or 0 if the object has no such property.
  */
 
-static int set_drm_object_property(drmModeAtomicReq *req, struct drm_object *obj,
-				   const char *name, uint64_t value)
+static uint32_t find_drm_object_property(struct drm_object *obj, const char *name)
 {
-    int i;
-    uint32_t prop_id = 0;
-
-    for (i = 0; i < obj->props->count_props; i++) {
-        if (!strcmp(obj->props_info[i]->name, name)) {
-            prop_id = obj->props_info[i]->prop_id;
-            break;
-        }
+    for (int i = 0; i < obj->props->count_props; i++) {
+        if (!strcmp(obj->props_info[i]->name, name))
+            return obj->props_info[i]->prop_id;
     }
 
-    if (prop_id == 0) {
-        fprintf(stderr, "no object property: %s\n", name);
+    fprintf(stderr, "no object property: %s\n", name);
+    return 0;
+}
+
+/*
+ * set_drm_object_property() sets a property value to a CRTC, plane or
+ * connector object. The property id comes from struct modeset_props.
+ */
+
+static int set_drm_object_property(drmModeAtomicReq *req, struct drm_object *obj,
+				   uint32_t prop_id, uint64_t value)
+{
+    if (prop_id == 0)
         return -EINVAL;
-    }
 
     return drmModeAtomicAddProperty(req, obj->id, prop_id, value);
 }
@@ -428,6 +487,41 @@ static int modeset_find_plane(int fd, struct modeset_output *out)
     return ret;
 }
 
+/*
+ * modeset_choose_format() picks the smallest format supported by the plane
+ * that keeps the palette colors. ABGR8888 is used if the plane lists none.
+ */
+
+static void modeset_choose_format(int fd, struct modeset_output *out)
+{
+    drmModePlanePtr plane = drmModeGetPlane(fd, out->plane.id);
+
+    out->format = &modeset_formats[MODESET_FORMAT_COUNT - 1];
+
+    if (!plane) {
+        fprintf(stderr, "drmModeGetPlane(%u) failed: %s\n", out->plane.id,
+                strerror(errno));
+        return;
+    }
+
+    for (int i = 0; i < MODESET_FORMAT_COUNT; i++) {
+        const struct modeset_format *f = &modeset_formats[i];
+        bool supported = false;
+
+        for (int j = 0; j < plane->count_formats && !supported; j++)
+            supported = plane->formats[j] == f->fourcc;
+
+        if (supported && palette_fits_format(f->pixel_format)) {
+            out->format = f;
+            break;
+        }
+    }
+
+    drmModeFreePlane(plane);
+
+    fprintf(stderr, "plane %u uses format %s\n", out->plane.id, out->format->name);
+}
+
 /*
  * modeset_drm_object_fini() is a new helper function that destroys CRTCs,
  * connectors and planes
@@ -453,6 +547,7 @@ static int modeset_setup_objects(int fd, struct modeset_output *out)
     struct drm_object *connector = &out->connector;
     struct drm_object *crtc = &out->crtc;
     struct drm_object *plane = &out->plane;
+    struct modeset_props *prop = &out->prop;
 
     /* retrieve connector properties from the device */
     modeset_get_object_properties(fd, connector, DRM_MODE_OBJECT_CONNECTOR);
@@ -469,8 +564,38 @@ static int modeset_setup_objects(int fd, struct modeset_output *out)
     if (!plane->props)
         goto out_plane;
 
+    /* resolve the ids of the properties we commit */
+    prop->conn_crtc_id = find_drm_object_property(connector, "CRTC_ID");
+    prop->crtc_mode_id = find_drm_object_property(crtc, "MODE_ID");
+    prop->crtc_active = find_drm_object_property(crtc, "ACTIVE");
+    prop->plane_fb_id = find_drm_object_property(plane, "FB_ID");
+    prop->plane_crtc_id = find_drm_object_property(plane, "CRTC_ID");
+    prop->plane_src_x = find_drm_object_property(plane, "SRC_X");
+    prop->plane_src_y = find_drm_object_property(plane, "SRC_Y");
+    prop->plane_src_w = find_drm_object_property(plane, "SRC_W");
+    prop->plane_src_h = find_drm_object_property(plane, "SRC_H");
+    prop->plane_crtc_x = find_drm_object_property(plane, "CRTC_X");
+    prop->plane_crtc_y = find_drm_object_property(plane, "CRTC_Y");
+    prop->plane_crtc_w = find_drm_object_property(plane, "CRTC_W");
+    prop->plane_crtc_h = find_drm_object_property(plane, "CRTC_H");
+    prop->plane_zpos = find_drm_object_property(plane, "zpos");
+
+    /* optional, without it the driver updates the whole plane */
+    prop->plane_damage_clips = find_drm_object_property(plane, "FB_DAMAGE_CLIPS");
+    if (!prop->plane_damage_clips)
+        fprintf(stderr, "plane %u has no damage clips support\n", plane->id);
+
+    if (!prop->conn_crtc_id || !prop->crtc_mode_id || !prop->crtc_active ||
+        !prop->plane_fb_id || !prop->plane_crtc_id ||
+        !prop->plane_src_x || !prop->plane_src_y || !prop->plane_src_w || !prop->plane_src_h ||
+        !prop->plane_crtc_x || !prop->plane_crtc_y || !prop->plane_crtc_w || !prop->plane_crtc_h ||
+        !prop->plane_zpos)
+        goto out_props;
+
     return 0;
 
+out_props:
+    modeset_drm_object_fini(plane);
 out_plane:
     modeset_drm_object_fini(crtc);
 out_crtc:
@@ -495,7 +620,8 @@ static void modeset_destroy_objects(int fd, struct modeset_output *out)
  * modeset_create_fb() stays the same.
  */
 
-static int modeset_create_fb(int fd, struct modeset_buf *buf)
+static int modeset_create_fb(int fd, struct modeset_buf *buf,
+                             const struct modeset_format *format)
 {
     struct drm_mode_create_dumb creq;
     struct drm_mode_destroy_dumb dreq;
@@ -507,7 +633,7 @@ static int modeset_create_fb(int fd, struct modeset_buf *buf)
     memset(&creq, 0, sizeof(creq));
     creq.width = buf->width;
     creq.height = buf->height;
-    creq.bpp = 32;
+    creq.bpp = format->bpp;
     ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
     if (ret < 0) {
         fprintf(stderr, "cannot create dumb buffer (%d): %m\n",
@@ -521,7 +647,7 @@ static int modeset_create_fb(int fd, struct modeset_buf *buf)
     /* create framebuffer object for the dumb-buffer */
     handles[0] = buf->handle;
     pitches[0] = buf->stride;
-    ret = drmModeAddFB2(fd, buf->width, buf->height, DRM_FORMAT_ABGR8888,
+    ret = drmModeAddFB2(fd, buf->width, buf->height, format->fourcc,
                         handles, pitches, offsets, &buf->fb, 0);
     if (ret) {
         fprintf(stderr, "cannot create framebuffer (%d): %m\n",
@@ -597,23 +723,32 @@ static int modeset_setup_framebuffers(int fd,
     int i, ret;
 
     /* setup the front and back framebuffers */
-    for (i = 0; i < 2; i++) {
+    for (i = 0; i < MODESET_BUFFERS; i++) {
 
         /* copy mode info to buffer */
-        out->bufs[i].width = FB_WIDTH;
-        out->bufs[i].height = FB_HEIGHT;
+        out->bufs[i].width = osd_width;
+        out->bufs[i].height = osd_height;
+
+        /* nothing was copied to the buffer yet */
+        damage_map_init(&out->bufs[i].stale, osd_width, osd_height);
+        damage_map_fill(&out->bufs[i].stale);
+        damage_map_init(&out->bufs[i].drawn, osd_width, osd_height);
+        damage_map_fill(&out->bufs[i].drawn);
 
         /* create a framebuffer for the buffer */
-        ret = modeset_create_fb(fd, &out->bufs[i]);
+        ret = modeset_create_fb(fd, &out->bufs[i], out->format);
         if (ret) {
-            /* the second framebuffer creation failed, so
-             * we have to destroy the first before returning */
-            if (i == 1)
-                modeset_destroy_fb(fd, &out->bufs[0]);
+            /* destroy the framebuffers created so far before returning */
+            while (i-- > 0)
+                modeset_destroy_fb(fd, &out->bufs[i]);
             return ret;
         }
     }
 
+    out->front_buf = 0;
+    out->pending_buf = -1;
+    out->queued_buf = -1;
+
     return 0;
 }
 
@@ -629,12 +764,13 @@ static void modeset_output_destroy(int fd, struct modeset_output *out)
     modeset_destroy_objects(fd, out);
 
     /* destroy front/back framebuffers */
-    modeset_destroy_fb(fd, &out->bufs[0]);
-    modeset_destroy_fb(fd, &out->bufs[1]);
+    for (int i = 0; i < MODESET_BUFFERS; i++)
+        modeset_destroy_fb(fd, &out->bufs[i]);
 
     /* destroy mode blob property */
     drmModeDestroyPropertyBlob(fd, out->mode_blob_id);
 
+    drmModeAtomicFree(out->flip_req);
     free(out);
 }
 
@@ -704,6 +840,8 @@ static struct modeset_output *modeset_output_create(int fd, drmModeRes *res,
         goto out_blob;
     }
 
+    modeset_choose_format(fd, out);
+
     /* gather properties of our connector, CRTC and planes */
     ret = modeset_setup_objects(fd, out);
     if (ret) {
@@ -719,6 +857,8 @@ static struct modeset_output *modeset_output_create(int fd, drmModeRes *res,
         goto out_obj;
     }
 
+    out->flip_req = drmModeAtomicAlloc();
+
     return out;
 
 out_obj:
@@ -788,62 +928,65 @@ static int modeset_prepare(int fd)
  */
 
 static int modeset_atomic_prepare_commit(int fd, struct modeset_output *out,
-					 drmModeAtomicReq *req)
+					 drmModeAtomicReq *req, struct modeset_buf *buf)
 {
     struct drm_object *plane = &out->plane;
-    struct modeset_buf *buf = &out->bufs[out->front_buf ^ 1];
+    struct modeset_props *prop = &out->prop;
 
     /* set id of the CRTC id that the connector is using */
-    if (set_drm_object_property(req, &out->connector, "CRTC_ID", out->crtc.id) < 0)
+    if (set_drm_object_property(req, &out->connector, prop->conn_crtc_id, out->crtc.id) < 0)
         return -1;
 
     /* set the mode id of the CRTC; this property receives the id of a blob
      * property that holds the struct that actually contains the mode info */
-    if (set_drm_object_property(req, &out->crtc, "MODE_ID", out->mode_blob_id) < 0)
+    if (set_drm_object_property(req, &out->crtc, prop->crtc_mode_id, out->mode_blob_id) < 0)
         return -1;
 
     /* set the CRTC object as active */
-    if (set_drm_object_property(req, &out->crtc, "ACTIVE", 1) < 0)
+    if (set_drm_object_property(req, &out->crtc, prop->crtc_active, 1) < 0)
         return -1;
 
     /* set properties of the plane related to the CRTC and the framebuffer */
-    if (set_drm_object_property(req, plane, "FB_ID", buf->fb) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_fb_id, buf->fb) < 0)
         return -1;
-    if (set_drm_object_property(req, plane, "CRTC_ID", out->crtc.id) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_crtc_id, out->crtc.id) < 0)
         return -1;
-    if (set_drm_object_property(req, plane, "SRC_X", 0) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_src_x, 0) < 0)
         return -1;
-    if (set_drm_object_property(req, plane, "SRC_Y", 0) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_src_y, 0) < 0)
         return -1;
-    if (set_drm_object_property(req, plane, "SRC_W", buf->width << 16) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_src_w, buf->width << 16) < 0)
         return -1;
-    if (set_drm_object_property(req, plane, "SRC_H", buf->height << 16) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_src_h, buf->height << 16) < 0)
         return -1;
-    if (set_drm_object_property(req, plane, "CRTC_X", 0) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_crtc_x, 0) < 0)
         return -1;
-    if (set_drm_object_property(req, plane, "CRTC_Y", 0) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_crtc_y, 0) < 0)
         return -1;
-    if (set_drm_object_property(req, plane, "CRTC_W", out->mode.hdisplay) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_crtc_w, out->mode.hdisplay) < 0)
         return -1;
-    if (set_drm_object_property(req, plane, "CRTC_H", out->mode.vdisplay) < 0)
+    if (set_drm_object_property(req, plane, prop->plane_crtc_h, out->mode.vdisplay) < 0)
         return -1;
 
     return 0;
 }
 
 /*
- * Draw on back framebuffer before the page-flip is requested.
+ * Draw on front framebuffer before the initial modeset.
  */
 
 static void modeset_paint_framebuffer(struct modeset_output *out, uint32_t color)
 {
     struct modeset_buf *buf;
 
-    buf = &out->bufs[out->front_buf ^ 1];
+    buf = &out->bufs[out->front_buf];
     for (int j = 0; j < buf->height; ++j) {
         for (int k = 0; k < buf->width; ++k) {
-            int off = buf->stride * j + k * 4;
-            *(uint32_t*)(buf->map + off) = color;
+            int off = buf->stride * j + k * (out->format->bpp / 8);
+            if (out->format->bpp == 16)
+                *(uint16_t*)(buf->map + off) = color;
+            else
+                *(uint32_t*)(buf->map + off) = color;
         }
     }
 }
@@ -855,9 +998,9 @@ static void modeset_paint_framebuffer(struct modeset_output *out, uint32_t color
  * we're only using the primary plane, but we could also be updating other
  * planes in the same atomic commit.
  *
- * Just like in modeset_perform_modeset(), we first setup everything with
- * modeset_atomic_prepare_commit() and then actually perform the atomic commit.
- * But there are some important differences:
+ * Unlike modeset_perform_modeset(), the commit doesn't repeat the state set by
+ * modeset_atomic_prepare_commit(): atomic state persists, so only FB_ID of the
+ * plane changes. There are some other important differences:
  *
  * 1. Here we just want to perform a commit that changes the state of a specific
  *    output, and in modeset_perform_modeset() we did an atomic commit that was
@@ -880,17 +1023,21 @@ static void modeset_paint_framebuffer(struct modeset_output *out, uint32_t color
  *    glitch (a modeset can cause unecessary latency and also blank the screen).
  */
 
-static void modeset_draw_commit(int fd, struct modeset_output *out)
+static void modeset_draw_commit(int fd, struct modeset_output *out, int buf_index,
+                                uint32_t damage_blob)
 {
-    drmModeAtomicReq *req;
+    drmModeAtomicReq *req = out->flip_req;
     int ret, flags;
 
-    /* prepare output for atomic commit */
-    req = drmModeAtomicAlloc();
-    ret = modeset_atomic_prepare_commit(fd, out, req);
+    /* The modeset already set up the CRTC and the plane, a flip only changes
+     * the framebuffer. The request is allocated once and emptied here. */
+    drmModeAtomicSetCursor(req, 0);
+    ret = set_drm_object_property(req, &out->plane, out->prop.plane_fb_id, out->bufs[buf_index].fb);
+    if (ret >= 0 && damage_blob)
+        ret = set_drm_object_property(req, &out->plane, out->prop.plane_damage_clips, damage_blob);
     if (ret < 0) {
         fprintf(stderr, "prepare atomic commit failed, %d\n", errno);
-        return;
+        goto out_blob;
     }
 
     /* We've just draw on the framebuffer, prepared the commit and now it's
@@ -902,16 +1049,98 @@ static void modeset_draw_commit(int fd, struct modeset_output *out)
      * this because there are mechanisms to know when the commit is complete
      * (like page flip event, explained above).
      */
-    flags = DRM_MODE_ATOMIC_NONBLOCK;
-    ret = drmModeAtomicCommit(fd, req, flags, NULL);
-    drmModeAtomicFree(req);
+    flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+    ret = drmModeAtomicCommit(fd, req, flags, out);
 
     if (ret < 0) {
         fprintf(stderr, "atomic commit failed, %d\n", errno);
-        return;
+        goto out_blob;
     }
 
-    out->front_buf ^= 1;
+    /* the old front buffer is scanned out until the flip event arrives */
+    out->pending_buf = buf_index;
+
+out_blob:
+    /* the committed plane state holds its own reference */
+    if (damage_blob)
+        drmModeDestroyPropertyBlob(fd, damage_blob);
+}
+
+/*
+ * modeset_damage_blob() creates an FB_DAMAGE_CLIPS blob from the area where
+ * the new buffer differs from the one it replaces. It returns 0 if the plane
+ * doesn't support damage clips or the blob can't be created; without clips
+ * the driver treats the whole plane as damaged.
+ */
+
+static uint32_t modeset_damage_blob(int fd, struct modeset_output *out, const struct damage_map *dm)
+{
+    struct clip_rect rects[DAMAGE_MAX_RECTS];
+    struct drm_mode_rect clips[DAMAGE_MAX_RECTS];
+    uint32_t blob_id;
+    int n;
+
+    if (!out->prop.plane_damage_clips)
+        return 0;
+
+    n = damage_map_to_rects(dm, rects, DAMAGE_MAX_RECTS);
+    if (n == 0)
+        return 0;
+
+    /* clip rectangles are inclusive, DRM ones exclude x2 and y2 */
+    for (int i = 0; i < n; i++)
+    {
+        clips[i].x1 = rects[i].x0;
+        clips[i].y1 = rects[i].y0;
+        clips[i].x2 = rects[i].x1 + 1;
+        clips[i].y2 = rects[i].y1 + 1;
+    }
+
+    if (drmModeCreatePropertyBlob(fd, clips, n * sizeof(clips[0]), &blob_id) != 0)
+    {
+        fprintf(stderr, "cannot create damage clips blob, %d\n", errno);
+        return 0;
+    }
+    return blob_id;
+}
+
+/*
+ * modeset_page_flip_event() is called by drmHandleEvent() when a flip queued by
+ * modeset_draw_commit() has completed. The user data of the commit is the output.
+ */
+
+static void modeset_page_flip_event(int fd, unsigned int sequence, unsigned int tv_sec,
+                                    unsigned int tv_usec, unsigned int crtc_id, void *user_data)
+{
+    struct modeset_output *out = user_data;
+
+    out->front_buf = out->pending_buf;
+    out->pending_buf = -1;
+
+    /* a frame was drawn meanwhile, flip to it now */
+    if (out->queued_buf >= 0)
+    {
+        int buf_index = out->queued_buf;
+
+        out->queued_buf = -1;
+        modeset_draw_commit(fd, out, buf_index, out->queued_damage);
+        out->queued_damage = 0;
+    }
+}
+
+/*
+ * modeset_back_buffer() returns the index of a buffer that is neither scanned
+ * out nor waiting for scanout, or -1 if all of them are busy.
+ */
+
+static int modeset_back_buffer(const struct modeset_output *out)
+{
+    for (int i = 0; i < MODESET_BUFFERS; i++)
+    {
+        if (i != out->front_buf && i != out->pending_buf && i != out->queued_buf)
+            return i;
+    }
+    return -1;
 }
 
 
@@ -938,7 +1167,7 @@ static int modeset_perform_modeset(int fd)
     /* prepare modeset on all outputs */
     req = drmModeAtomicAlloc();
     for (iter = output_list; iter; iter = iter->next) {
-        ret = modeset_atomic_prepare_commit(fd, iter, req);
+        ret = modeset_atomic_prepare_commit(fd, iter, req, &iter->bufs[iter->front_buf]);
         if (ret < 0)
             break;
     }
@@ -959,7 +1188,7 @@ static int modeset_perform_modeset(int fd)
     /* draw on back framebuffer of all outputs */
     for (iter = output_list; iter; iter = iter->next)
     {
-        if (set_drm_object_property(req, &iter->plane, "zpos", ZPOS) < 0)
+        if (set_drm_object_property(req, &iter->plane, iter->prop.plane_zpos, ZPOS) < 0)
         {
             fprintf(stderr, "Unable to set zpos %d for primary plane\n", ZPOS);
             drmModeAtomicFree(req);
@@ -992,7 +1221,7 @@ static void modeset_cleanup(int fd)
 
     for(iter = output_list; iter; iter = iter->next)
     {
-        set_drm_object_property(req, &iter->plane, "zpos", 0);
+        set_drm_object_property(req, &iter->plane, iter->prop.plane_zpos, 0);
     }
 
     ret = drmModeAtomicCommit(fd, req, 0, NULL);
@@ -1060,12 +1289,126 @@ out_return:
 }
 
 
-void drm_display_buffer(void *src_buf)
+/*
+ * drm_event_fd() returns the DRM fd for the caller's poll loop. It becomes
+ * readable when a page-flip completes, drm_handle_events() must be called then.
+ */
+
+int drm_event_fd(void)
+{
+    return drm_fd;
+}
+
+void drm_handle_events(void)
+{
+    drmEventContext ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.version = 3;
+    ev.page_flip_handler2 = modeset_page_flip_event;
+
+    if (drmHandleEvent(drm_fd, &ev) != 0)
+    {
+        fprintf(stderr, "drmHandleEvent failed, %d\n", errno);
+    }
+}
+
+/*
+ * drm_back_buffer_free() returns non-zero when every output has a buffer to draw
+ * into. With a flip pending the third buffer is used, so this only fails when
+ * a whole frame is already queued behind the pending flip.
+ */
+
+int drm_back_buffer_free(void)
+{
+    for (struct modeset_output *iter = output_list; iter; iter = iter->next)
+    {
+        if (modeset_back_buffer(iter) < 0)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * drm_refresh_rate() returns the refresh rate of the first output in Hz.
+ */
+
+int drm_refresh_rate(void)
 {
+    return output_list ? output_list->mode.vrefresh : 0;
+}
+
+/*
+ * drm_back_buffer() returns the mapped back buffer of the first output, so the
+ * OSD can be rendered in place, and the areas holding pixels of the frame that
+ * was drawn into it before. Must only be called when drm_back_buffer_free().
+ */
+
+uint8_t *drm_back_buffer(int *stride, struct damage_map **drawn)
+{
+    struct modeset_buf *buf = &output_list->bufs[modeset_back_buffer(output_list)];
+
+    *stride = buf->stride;
+    *drawn = &buf->drawn;
+    return buf->map;
+}
+
+
+/*
+ * drm_display_buffer() copies the OSD image to the back buffer of every output,
+ * converting it to the plane format, and flips it. Each buffer remembers what changed since it was filled, so only
+ * damaged rectangles are copied. If nothing changed, the front buffer already
+ * shows the current image and the output is left alone. A back buffer the OSD
+ * was rendered into in place is not copied. If a flip is still pending, the
+ * frame is queued and flipped from the page-flip event. The changed area is
+ * passed to the driver as FB_DAMAGE_CLIPS when the plane supports it.
+ */
+
+void drm_display_buffer(const struct render_target *src, const struct damage_map *damage)
+{
+    struct clip_rect rects[DAMAGE_MAX_RECTS];
+
+    if (damage_map_empty(damage))
+        return;
+
     for (struct modeset_output *iter = output_list; iter; iter = iter->next)
     {
-        struct modeset_buf *dst_buf = &iter->bufs[iter->front_buf ^ 1];
-        memcpy(dst_buf->map, src_buf, dst_buf->size);
-        modeset_draw_commit(drm_fd, iter);
+        int buf_index = modeset_back_buffer(iter);
+
+        for (int i = 0; i < MODESET_BUFFERS; i++)
+            damage_map_merge(&iter->bufs[i].stale, damage);
+
+        // All buffers are busy, stale areas are copied on the next frame
+        if (buf_index < 0)
+            continue;
+
+        struct modeset_buf *dst_buf = &iter->bufs[buf_index];
+
+        if (dst_buf->map != src->base)
+        {
+            const struct modeset_format *format = iter->format;
+            int n = damage_map_to_rects(&dst_buf->stale, rects, DAMAGE_MAX_RECTS);
+
+            for (int i = 0; i < n; i++)
+            {
+                render_target_pack(src, &rects[i],
+                                   dst_buf->map + rects[i].y0 * dst_buf->stride + rects[i].x0 * (format->bpp / 8),
+                                   dst_buf->stride, format->pixel_format);
+            }
+        }
+
+        damage_map_clear(&dst_buf->stale);
+
+        // Buffer that is replaced by the flip differs from the new image by its stale area
+        int prev_index = iter->pending_buf < 0 ? iter->front_buf : iter->pending_buf;
+        uint32_t damage_blob = modeset_damage_blob(drm_fd, iter, &iter->bufs[prev_index].stale);
+
+        if (iter->pending_buf < 0)
+        {
+            modeset_draw_commit(drm_fd, iter, buf_index, damage_blob);
+        } else {
+            iter->queued_buf = buf_index;
+            iter->queued_damage = damage_blob;
+        }
     }
 }
@@ -26,7 +26,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <assert.h>
 #include <math.h>
 #include <stdint.h>
@@ -43,10 +45,12 @@
 
 #ifdef __GST_OPENGL__
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #endif
 
 #include "osdrender.h"
 #include "graphengine.h"
+#include "displaylist.h"
 #include "math3d.h"
 #include "fonts.h"
 #include "font12x18.h"
@@ -55,10 +59,51 @@
 
 static uint8_t* video_buf_int = NULL;
 
+int osd_width = GRAPHICS_WIDTH, osd_height = GRAPHICS_HEIGHT;
+static struct render_target osd_target;
+
+__thread struct render_target *draw_target = &osd_target;
+
+static void render_pool_execute(const struct display_list *dl);
+
+// Incremented for each recorded frame, ages cached circle tables
+static unsigned int circle_frame = 1;
+
+// Backends with persistent buffers redraw only damaged area
+static struct damage_map osd_drawn;     // drawn in current frame
+static struct damage_map frame_damage;  // changed since previous frame
+
+static void damage_init(void)
+{
+    damage_map_init(&osd_drawn, osd_target.width, osd_target.height);
+    damage_map_init(&frame_damage, osd_target.width, osd_target.height);
+
+    // Buffer content is undefined, clear and present it entirely
+    damage_map_fill(&osd_drawn);
+    osd_target.drawn = &osd_drawn;
+}
+
+// Erase what was drawn in previous frame
+static void damage_begin_frame(void)
+{
+    frame_damage = osd_drawn;
+    render_target_clear(&osd_target, &osd_drawn);
+    damage_map_clear(&osd_drawn);
+}
+
+// Area changed since previous frame: drawn in previous or current one
+static const struct damage_map* damage_end_frame(void)
+{
+    damage_map_merge(&frame_damage, &osd_drawn);
+    return &frame_damage;
+}
+
 #ifdef __BCM_OPENVG__
 STATE_T ogl_state;
 static int corr_x, corr_y;
 static float corr_scale_x, corr_scale_y;
+static VGImage osd_image;
+static uint8_t *osd_rgba = NULL;        // bottom-up RGBA copy uploaded to osd_image
 
 void render_init(int shift_x, int shift_y, float scale_x, float scale_y)
 {
@@ -70,12 +115,19 @@ void render_init(int shift_x, int shift_y, float scale_x, float scale_y)
     corr_scale_x = scale_x;
     corr_scale_y = scale_y;
 
-    fprintf(stderr, "Screen HW %dx%d, virtual %dx%d, corr %d, %d, %f, %f \n", ogl_state.screen_width, ogl_state.screen_height, GRAPHICS_WIDTH, GRAPHICS_HEIGHT, corr_x, corr_y, corr_scale_x, corr_scale_y);
-    video_buf_int = malloc(GRAPHICS_WIDTH * GRAPHICS_HEIGHT * 4);
+    fprintf(stderr, "Screen HW %dx%d, virtual %dx%d, corr %d, %d, %f, %f \n", ogl_state.screen_width, ogl_state.screen_height, osd_width, osd_height, corr_x, corr_y, corr_scale_x, corr_scale_y);
+    video_buf_int = malloc(osd_width * osd_height * sizeof(pixel_t));
+    osd_rgba = malloc(osd_width * osd_height * 4);
+
+    render_target_init(&osd_target, video_buf_int, osd_width * sizeof(pixel_t),
+                       osd_width, osd_height, OSD_PIXEL_FORMAT);
+    damage_init();
+
+    osd_image = vgCreateImage(VG_sABGR_8888, osd_target.width, osd_target.height, VG_IMAGE_QUALITY_NONANTIALIASED);
 }
 
 void clearGraphics(void) {
-    memset(video_buf_int, '\0', GRAPHICS_WIDTH * GRAPHICS_HEIGHT * 4);
+    damage_begin_frame();
 }
 
 void* displayGraphics(void) {
@@ -86,25 +138,33 @@ void* displayGraphics(void) {
 
     vgLoadIdentity();
 
-    // convert video buffer into image
-    unsigned int dstride = GRAPHICS_WIDTH * 4;
+    // update changed parts of the image
+    struct clip_rect rects[DAMAGE_MAX_RECTS];
+    unsigned int dstride = osd_target.width * 4;
     VGImageFormat rgbaFormat = VG_sABGR_8888;
+    int n = damage_map_to_rects(damage_end_frame(), rects, DAMAGE_MAX_RECTS);
 
-    VGImage img = vgCreateImage(rgbaFormat, GRAPHICS_WIDTH, GRAPHICS_HEIGHT, VG_IMAGE_QUALITY_NONANTIALIASED);
+    for (int i = 0; i < n; i++)
+    {
+        // image rows are bottom-up, the region starts at its bottom row
+        int y = osd_target.height - 1 - rects[i].y1;
+        render_target_expand(&osd_target, &rects[i],
+                             osd_rgba + (osd_target.height - 1 - rects[i].y0) * dstride + rects[i].x0 * 4, -dstride);
+        vgImageSubData(osd_image, (void *)(osd_rgba + y * dstride + rects[i].x0 * 4), dstride, rgbaFormat,
+                       rects[i].x0, y, rects[i].x1 - rects[i].x0 + 1, rects[i].y1 - rects[i].y0 + 1);
+    }
 
-    float screen_scale_x = (float)ogl_state.screen_width / GRAPHICS_WIDTH * corr_scale_x;
-    float screen_scale_y = (float)ogl_state.screen_height / GRAPHICS_HEIGHT * corr_scale_y;
+    float screen_scale_x = (float)ogl_state.screen_width / osd_target.width * corr_scale_x;
+    float screen_scale_y = (float)ogl_state.screen_height / osd_target.height * corr_scale_y;
     float screen_scale = MIN(screen_scale_x, screen_scale_y);
 
-    vgImageSubData(img, (void *)video_buf_int, dstride, rgbaFormat, 0, 0, GRAPHICS_WIDTH, GRAPHICS_HEIGHT);
     vgSeti(VG_MATRIX_MODE, VG_MATRIX_IMAGE_USER_TO_SURFACE);
     vgLoadIdentity();
     vgTranslate((1.0 - screen_scale/screen_scale_x) / 2.0 * ogl_state.screen_width  + corr_x,
                 (1.0 - screen_scale/screen_scale_y) / 2.0 * ogl_state.screen_height + corr_y);
     vgScale(screen_scale, screen_scale);
-    vgDrawImage(img);
+    vgDrawImage(osd_image);
     vgSeti(VG_MATRIX_MODE, VG_MATRIX_PATH_USER_TO_SURFACE);
-    vgDestroyImage(img);
 
     // display
     assert(vgGetError() == VG_NO_ERROR);
@@ -113,93 +173,1227 @@ void* displayGraphics(void) {
     return NULL;
 }
 
+// eglSwapBuffers() blocks until the back buffer is free
+int render_event_fd(void)
+{
+    return -1;
+}
+
+void render_handle_events(void)
+{
+}
+
+int render_ready(void)
+{
+    return 1;
+}
+
+int render_refresh_rate(void)
+{
+    return 0;
+}
+
 #endif
 
 
 #ifdef __GST_OPENGL__
-static GstBuffer *gst_buffer;
-static GstMapInfo info_in;
-pthread_mutex_t video_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Pool buffers keep the frame they were filled with. The stale area differs
+// from the current image and is refreshed when the buffer is reused.
+struct gst_osd_buffer
+{
+    struct gst_osd_buffer *next;
+    struct damage_map stale;
+};
+
+static GstBufferPool *gst_pool = NULL;
+static GstBuffer *gst_buffer = NULL;        // last pushed frame
+static struct gst_osd_buffer *gst_osd_buffers = NULL;
+static pthread_mutex_t gst_osd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static GQuark gst_osd_quark;
+
+osd_output_t osd_output = OSD_OUTPUT_MIXER;
+
+// Overlay composition: one rectangle per drawn area, unchanged rectangles
+// are reused so sinks can keep their uploaded copy
+struct gst_osd_rect
+{
+    struct clip_rect r;
+    GstVideoOverlayRectangle *rect;
+};
+
+static struct gst_osd_rect osd_rects[2][DAMAGE_MAX_RECTS];
+static int osd_rect_count[2];
+static int osd_rect_index = 0;
+static GstVideoOverlayComposition *gst_composition = NULL;    // last attached composition
+static pixel_t *osd_rect_pixels = NULL;     // frame the cached rectangles were created from
+static int video_width = GRAPHICS_WIDTH, video_height = GRAPHICS_HEIGHT;
+
+// Called when the pool frees a buffer
+static void gst_osd_buffer_free(gpointer data)
+{
+    struct gst_osd_buffer *ob = data;
+
+    pthread_mutex_lock(&gst_osd_mutex);
+    for (struct gst_osd_buffer **p = &gst_osd_buffers; *p; p = &(*p)->next)
+    {
+        if (*p == ob)
+        {
+            *p = ob->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&gst_osd_mutex);
+    free(ob);
+}
+
+// Pool is created on first use, GStreamer is initialized by the gst thread
+static void gst_pool_init(void)
+{
+    GstStructure *config;
+
+    gst_osd_quark = g_quark_from_static_string("wfb-osd-buffer");
+    gst_pool = gst_buffer_pool_new();
+    config = gst_buffer_pool_get_config(gst_pool);
+    // Not bounded: a full pool would block rendering. Buffers come back once
+    // downstream drops the frames showing them, so it grows only by the
+    // number of frames queued in the pipeline.
+    gst_buffer_pool_config_set_params(config, NULL, osd_target.width * osd_target.height * 4, 3, 0);
+
+    if (!gst_buffer_pool_set_config(gst_pool, config) || !gst_buffer_pool_set_active(gst_pool, TRUE))
+    {
+        fprintf(stderr, "Unable to setup OSD buffer pool\n");
+        exit(1);
+    }
+}
 
 void render_init(int shift_x, int shift_y, float scale_x, float scale_y)
 {
-    gst_buffer = NULL;
-    video_buf_int = NULL;
+    video_buf_int = malloc(osd_width * osd_height * sizeof(pixel_t));
+    render_target_init(&osd_target, video_buf_int, osd_width * sizeof(pixel_t), osd_width, osd_height, OSD_PIXEL_FORMAT);
+    damage_init();
 }
 
 void clearGraphics(void)
 {
-    gst_buffer = gst_buffer_new_allocate(NULL, GRAPHICS_WIDTH * GRAPHICS_HEIGHT * 4, NULL);
-    gst_buffer_memset(gst_buffer, 0, 0, GRAPHICS_WIDTH * GRAPHICS_HEIGHT * 4);
-    gst_buffer_map(gst_buffer, &info_in, GST_MAP_WRITE);
-    video_buf_int = info_in.data;
+    damage_begin_frame();
+}
+
+/**
+ * render_set_output_size: set size of the video the overlay composition is
+ * attached to. OSD rectangles are scaled to it.
+ *
+ * @param       width, height   video frame size
+ */
+void render_set_output_size(int width, int height)
+{
+    if (width == video_width && height == video_height)
+    {
+        return;
+    }
+
+    video_width = width;
+    video_height = height;
+
+    // Cached rectangles and composition have the old size
+    for (int i = 0; i < osd_rect_count[osd_rect_index]; i++)
+    {
+        gst_video_overlay_rectangle_unref(osd_rects[osd_rect_index][i].rect);
+    }
+    osd_rect_count[osd_rect_index] = 0;
+
+    if (gst_composition != NULL)
+    {
+        gst_video_overlay_composition_unref(gst_composition);
+        gst_composition = NULL;
+    }
+    render_invalidate();
+}
+
+static int clip_rect_intersects(const struct clip_rect *a, const struct clip_rect *b)
+{
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+// Overlay rectangle with the pixels of an OSD area
+static GstVideoOverlayRectangle *create_overlay_rect(const struct clip_rect *r)
+{
+    int width = r->x1 - r->x0 + 1;
+    int height = r->y1 - r->y0 + 1;
+    GstBuffer *pixels = gst_buffer_new_allocate(NULL, width * height * 4, NULL);
+    GstVideoOverlayRectangle *rect;
+    GstMapInfo info;
+
+    gst_buffer_add_video_meta(pixels, GST_VIDEO_FRAME_FLAG_NONE, GST_VIDEO_OVERLAY_COMPOSITION_FORMAT_RGB,
+                              width, height);
+    gst_buffer_map(pixels, &info, GST_MAP_WRITE);
+    render_target_expand(&osd_target, r, info.data, width * 4);
+
+    // Composition format is BGRA in memory
+    for (uint8_t *p = info.data; p < info.data + width * height * 4; p += 4)
+    {
+        uint8_t t = p[0];
+        p[0] = p[2];
+        p[2] = t;
+    }
+    gst_buffer_unmap(pixels, &info);
+
+    rect = gst_video_overlay_rectangle_new_raw(pixels,
+                                               r->x0 * video_width / osd_target.width,
+                                               r->y0 * video_height / osd_target.height,
+                                               width * video_width / osd_target.width,
+                                               height * video_height / osd_target.height,
+                                               GST_VIDEO_OVERLAY_FORMAT_FLAG_NONE);
+    gst_buffer_unref(pixels);
+    return rect;
+}
+
+// Find damaged tiles whose pixels differ from the frame of the cached
+// rectangles and copy them to it. Damage is the union of the previous and
+// the current drawn area, most of it is redrawn with the same pixels.
+static void changed_tiles(const struct damage_map *damage, struct damage_map *changed)
+{
+    size_t stride = osd_target.width * sizeof(pixel_t);
+
+    damage_map_init(changed, osd_target.width, osd_target.height);
+
+    if (osd_rect_pixels == NULL)
+    {
+        osd_rect_pixels = calloc(osd_target.height, stride);
+        assert(osd_rect_pixels != NULL);
+        damage_map_fill(changed);
+    }
+
+    for (int r = 0; r < damage->rows; r++)
+    {
+        int y0 = r * DAMAGE_TILE_HEIGHT;
+        int y1 = MIN(y0 + DAMAGE_TILE_HEIGHT, osd_target.height);
+
+        for (int c = 0; c < damage->cols; c++)
+        {
+            if (!(damage->tiles[r] & (1ull << c))) continue;
+
+            int x0 = c * DAMAGE_TILE_WIDTH;
+            size_t size = (MIN(x0 + DAMAGE_TILE_WIDTH, osd_target.width) - x0) * sizeof(pixel_t);
+
+            for (int y = y0; y < y1; y++)
+            {
+                uint8_t *src = osd_target.base + osd_target.stride * y + x0 * sizeof(pixel_t);
+                uint8_t *dst = (uint8_t *)osd_rect_pixels + stride * y + x0 * sizeof(pixel_t);
+
+                if (memcmp(dst, src, size) != 0)
+                {
+                    memcpy(dst, src, size);
+                    changed->tiles[r] |= 1ull << c;
+                }
+            }
+        }
+    }
+}
+
+// Composition of the drawn area, NULL if nothing is drawn
+static GstVideoOverlayComposition *display_composition(const struct damage_map *damage)
+{
+    struct damage_map changed;
+    struct clip_rect damaged[DAMAGE_MAX_RECTS];
+    struct clip_rect drawn[DAMAGE_MAX_RECTS];
+    struct gst_osd_rect *prev = osd_rects[osd_rect_index];
+    struct gst_osd_rect *cur = osd_rects[osd_rect_index ^ 1];
+    int prev_count = osd_rect_count[osd_rect_index];
+    GstVideoOverlayComposition *comp = NULL;
+
+    changed_tiles(damage, &changed);
+
+    int nd = damage_map_to_rects(&changed, damaged, DAMAGE_MAX_RECTS);
+    int n = damage_map_to_rects(&osd_drawn, drawn, DAMAGE_MAX_RECTS);
+
+    for (int i = 0; i < n; i++)
+    {
+        cur[i].r = drawn[i];
+        cur[i].rect = NULL;
+
+        // Same area and no changed tile inside, rectangle shows the same pixels
+        for (int j = 0; j < prev_count && cur[i].rect == NULL; j++)
+        {
+            if (memcmp(&prev[j].r, &drawn[i], sizeof(drawn[i])) == 0)
+            {
+                int k = 0;
+                while (k < nd && !clip_rect_intersects(&damaged[k], &drawn[i])) k++;
+                if (k == nd)
+                {
+                    cur[i].rect = gst_video_overlay_rectangle_ref(prev[j].rect);
+                }
+            }
+        }
+
+        if (cur[i].rect == NULL)
+        {
+            cur[i].rect = create_overlay_rect(&drawn[i]);
+        }
+
+        if (comp == NULL)
+        {
+            comp = gst_video_overlay_composition_new(cur[i].rect);
+        } else {
+            gst_video_overlay_composition_add_rectangle(comp, cur[i].rect);
+        }
+    }
+
+    for (int j = 0; j < prev_count; j++)
+    {
+        gst_video_overlay_rectangle_unref(prev[j].rect);
+    }
+
+    osd_rect_count[osd_rect_index ^ 1] = n;
+    osd_rect_index ^= 1;
+
+    if (gst_composition != NULL)
+    {
+        gst_video_overlay_composition_unref(gst_composition);
+    }
+    gst_composition = comp != NULL ? gst_video_overlay_composition_ref(comp) : NULL;
+    return comp;
+}
+
+/**
+ * wrap_osd_buffer: make a frame for appsrc showing a pool buffer.
+ * The frame has metadata of its own, so the caller may timestamp it, and
+ * read-only memory holding a reference to the pool buffer. Pool buffer
+ * memory is never shared, the buffer is returned to the pool and reused
+ * once all frames showing it are dropped.
+ *
+ * @param       buffer  pool buffer
+ * @return      new buffer owned by the caller
+ */
+static GstBuffer *wrap_osd_buffer(GstBuffer *buffer)
+{
+    GstBuffer *frame;
+    GstMapInfo info;
+
+    // System memory of the pool buffer stays valid while it is referenced
+    gst_buffer_map(buffer, &info, GST_MAP_READ);
+    frame = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, info.data, info.size, 0, info.size,
+                                        gst_buffer_ref(buffer), (GDestroyNotify)gst_buffer_unref);
+    gst_buffer_unmap(buffer, &info);
+    return frame;
+}
+
+// Frame is unchanged, present the previous one again
+static void *redisplayGraphics(void)
+{
+    if (osd_output == OSD_OUTPUT_COMPOSITION)
+    {
+        return gst_composition != NULL ? gst_video_overlay_composition_ref(gst_composition) : NULL;
+    }
+
+    return wrap_osd_buffer(gst_buffer);
 }
 
+/**
+ * displayGraphics: present the frame. Returns a new GstBuffer for appsrc, or
+ * a GstVideoOverlayComposition to attach to a video frame in overlay
+ * composition mode. The caller owns the returned reference.
+ */
 void *displayGraphics(void)
 {
-    gst_buffer_unmap(gst_buffer, &info_in);
-    return gst_buffer;
+    const struct damage_map *damage = damage_end_frame();
+    struct clip_rect rects[DAMAGE_MAX_RECTS];
+    struct gst_osd_buffer *ob;
+    GstBuffer *buffer;
+    GstMapInfo info;
+
+    if (osd_output == OSD_OUTPUT_COMPOSITION)
+    {
+        return display_composition(damage);
+    }
+
+    if (gst_pool == NULL)
+    {
+        gst_pool_init();
+    }
+
+    if (gst_buffer_pool_acquire_buffer(gst_pool, &buffer, NULL) != GST_FLOW_OK)
+    {
+        fprintf(stderr, "Unable to acquire OSD buffer\n");
+        exit(1);
+    }
+
+    ob = gst_mini_object_get_qdata(GST_MINI_OBJECT(buffer), gst_osd_quark);
+    pthread_mutex_lock(&gst_osd_mutex);
+
+    for (struct gst_osd_buffer *iter = gst_osd_buffers; iter; iter = iter->next)
+    {
+        damage_map_merge(&iter->stale, damage);
+    }
+
+    if (ob == NULL)
+    {
+        // New buffer, content is undefined
+        ob = malloc(sizeof(*ob));
+        damage_map_init(&ob->stale, osd_target.width, osd_target.height);
+        damage_map_fill(&ob->stale);
+        ob->next = gst_osd_buffers;
+        gst_osd_buffers = ob;
+        gst_mini_object_set_qdata(GST_MINI_OBJECT(buffer), gst_osd_quark, ob, gst_osd_buffer_free);
+    }
+
+    int n = damage_map_to_rects(&ob->stale, rects, DAMAGE_MAX_RECTS);
+    damage_map_clear(&ob->stale);
+    pthread_mutex_unlock(&gst_osd_mutex);
+
+    gst_buffer_map(buffer, &info, GST_MAP_WRITE);
+    for (int i = 0; i < n; i++)
+    {
+        render_target_expand(&osd_target, &rects[i], info.data + (rects[i].y0 * osd_target.width + rects[i].x0) * 4,
+                             osd_target.width * 4);
+    }
+    gst_buffer_unmap(buffer, &info);
+
+    // Previous buffer goes back to the pool when its last frame is dropped
+    if (gst_buffer != NULL)
+    {
+        gst_buffer_unref(gst_buffer);
+    }
+    gst_buffer = buffer;
+    return wrap_osd_buffer(buffer);
+}
+#endif
+
+
+#ifdef __DRM_ROCKCHIP__
+
+int drm_init(void);
+void drm_cleanup(void);
+void drm_display_buffer(const struct render_target *src, const struct damage_map *damage);
+int drm_event_fd(void);
+void drm_handle_events(void);
+int drm_back_buffer_free(void);
+int drm_refresh_rate(void);
+uint8_t *drm_back_buffer(int *stride, struct damage_map **drawn);
+
+#ifdef OSD_RGBA_BUFFER
+// Pixels need no conversion, render in place into the back buffer of the display
+static struct damage_map *back_drawn;   // drawn into the back buffer when it was last rendered
+
+void render_init(int shift_x, int shift_y, float scale_x, float scale_y)
+{
+    if(drm_init() != 0)
+    {
+        exit(1);
+    }
+    atexit(drm_cleanup);
+    render_target_init(&osd_target, NULL, osd_width * sizeof(pixel_t), osd_width, osd_height, OSD_PIXEL_FORMAT);
+    damage_init();
+}
+
+void clearGraphics(void)
+{
+    int stride;
+    uint8_t *map = drm_back_buffer(&stride, &back_drawn);
+
+    render_target_init(&osd_target, map, stride, osd_width, osd_height, OSD_PIXEL_FORMAT);
+
+    // Back buffer holds an older frame, not the previous one
+    frame_damage = osd_drawn;
+    render_target_clear(&osd_target, back_drawn);
+    damage_map_clear(&osd_drawn);
+    osd_target.drawn = &osd_drawn;
+}
+
+void* displayGraphics(void)
+{
+    *back_drawn = osd_drawn;
+    drm_display_buffer(&osd_target, damage_end_frame());
+    return NULL;
+}
+
+#else
+void render_init(int shift_x, int shift_y, float scale_x, float scale_y)
+{
+    if(drm_init() != 0)
+    {
+        exit(1);
+    }
+    atexit(drm_cleanup);
+    video_buf_int = malloc(osd_width * osd_height * sizeof(pixel_t));
+    render_target_init(&osd_target, video_buf_int, osd_width * sizeof(pixel_t), osd_width, osd_height, OSD_PIXEL_FORMAT);
+    damage_init();
+}
+
+void clearGraphics(void)
+{
+    damage_begin_frame();
+}
+
+void* displayGraphics(void)
+{
+    drm_display_buffer(&osd_target, damage_end_frame());
+    return NULL;
+}
+#endif
+
+int render_event_fd(void)
+{
+    return drm_event_fd();
+}
+
+void render_handle_events(void)
+{
+    drm_handle_events();
+}
+
+int render_ready(void)
+{
+    return drm_back_buffer_free();
+}
+
+int render_refresh_rate(void)
+{
+    return drm_refresh_rate();
+}
+
+#endif
+
+
+// Render time statistics, reported in debug mode
+#define RENDER_STATS_PERIOD 300
+
+static uint64_t render_time_sum = 0;
+static uint64_t render_time_max = 0;
+static int render_count = 0;
+static int render_skipped = 0;
+
+static void update_render_stats(uint64_t dt)
+{
+    render_time_sum += dt;
+    if (dt > render_time_max) render_time_max = dt;
+
+    if (++render_count < RENDER_STATS_PERIOD) return;
+
+    fprintf(stderr, "Render: %d frames, %d unchanged, avg %llu us, max %llu us, text cache %lu hits, %lu misses\n",
+            render_count, render_skipped,
+            (unsigned long long)(render_time_sum / render_count),
+            (unsigned long long)render_time_max,
+            text_cache_hits, text_cache_misses);
+
+    render_time_sum = 0;
+    render_time_max = 0;
+    render_count = 0;
+    render_skipped = 0;
 }
+
+// Display lists of the current and the previously drawn frame
+static struct display_list frame_lists[2];
+static int frame_index = 0;
+static int frame_drawn = 0;
+
+void* render(void)
+{
+    uint64_t start_ts = osd_debug ? GetSystimeNS() / 1000 : 0;
+    struct display_list *dl = &frame_lists[frame_index];
+    void *ret = NULL;
+
+    // Widgets record what they draw, nothing is rasterized yet
+    circle_frame++;
+    dl_reset(dl);
+    dl_recording = dl;
+    RenderScreen();
+    dl_recording = NULL;
+
+    if (dl_dump_file != NULL)
+    {
+        dl_write(dl, dl_dump_file);
+    }
+
+    // Persistent buffers already show an identical frame
+    if (frame_drawn && dl_equal(dl, &frame_lists[frame_index ^ 1]))
+    {
+        render_skipped++;
+#ifdef __GST_OPENGL__
+        ret = redisplayGraphics();
 #endif
+    } else
+    {
+        frame_drawn = 1;
+        frame_index ^= 1;
+
+        clearGraphics();
+        render_execute(dl);
+        ret = displayGraphics();
+    }
+
+    if (osd_debug)
+    {
+        update_render_stats(GetSystimeNS() / 1000 - start_ts);
+    }
+
+    return ret;
+}
+
+/**
+ * render_invalidate: draw and present the next frame even if it is
+ * identical to the previous one, e.g. when the output was rescaled.
+ */
+void render_invalidate(void)
+{
+    frame_drawn = 0;
+}
+
+/**
+ * render_execute: draw display list into the current target, by the pool
+ * of render threads if enabled with -t.
+ *
+ * @param       dl      display list to draw
+ */
+void render_execute(const struct display_list *dl)
+{
+    if (render_threads > 1)
+    {
+        render_pool_execute(dl);
+    } else {
+        dl_execute(dl);
+    }
+}
+
+//void drawArrow(uint16_t x, uint16_t y, uint16_t angle, uint16_t size_quarter)
+//{
+//	float sin_angle = sin_lookup_deg(angle);
+//	float cos_angle = cos_lookup_deg(angle);
+//	int16_t peak_x  = (int16_t)(sin_angle * size_quarter * 2);
+//	int16_t peak_y  = (int16_t)(cos_angle * size_quarter * 2);
+//	int16_t d_end_x = (int16_t)(cos_angle * size_quarter);
+//	int16_t d_end_y = (int16_t)(sin_angle * size_quarter);
+
+//	write_line_lm(x + peak_x, y - peak_y, x - peak_x - d_end_x, y + peak_y - d_end_y, 1, 1);
+//	write_line_lm(x + peak_x, y - peak_y, x - peak_x + d_end_x, y + peak_y + d_end_y, 1, 1);
+//	write_line_lm(x, y, x - peak_x - d_end_x, y + peak_y - d_end_y, 1, 1);
+//	write_line_lm(x, y, x - peak_x + d_end_x, y + peak_y + d_end_y, 1, 1);
+//}
+
+void drawBox(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2) {
+  write_line_lm(x1, y1, x2, y1, 1, 1);       // top
+  write_line_lm(x1, y1, x1, y2, 1, 1);       // left
+  write_line_lm(x2, y1, x2, y2, 1, 1);       // right
+  write_line_lm(x1, y2, x2, y2, 1, 1);       // bottom
+}
+
+// Colors of palette indices, color 0 = black, 1 = main, 2 = warn is index color + 1
+// BE: ABGR
+// LE: RGBA
+uint32_t osd_palette[PALETTE_SIZE] = {
+    0x00000000u,  // transparent
+    0xff000000u,  // black
+    0xff41ff00u,  // monochrome crt green
+    0xff0000ffu,  // red, warnings
+};
+
+static inline pixel_t pack_color(int opaq, int color)
+{
+    assert((opaq == 0 || opaq == 1) && (color >= 0 && color <= 2));
+#ifdef OSD_RGBA_BUFFER
+    return opaq ? osd_palette[color + 1] : 0u;
+#else
+    return opaq ? color + 1 : 0;
+#endif
+}
+
+// RGBA pixels of every combination of four palette indices
+static uint32_t expand_lut[256][4];
+static int expand_lut_ready = 0;
+
+static void build_expand_lut(void)
+{
+    for (int k = 0; k < 256; k++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            expand_lut[k][i] = osd_palette[(k >> (2 * i)) & 3];
+        }
+    }
+    expand_lut_ready = 1;
+}
+
+// Convert a run of palette indices, four pixels per table lookup
+static inline void expand_span(uint32_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        int k = (src[i] & 3) | (src[i + 1] & 3) << 2 | (src[i + 2] & 3) << 4 | (src[i + 3] & 3) << 6;
+        memcpy(dst + i, expand_lut[k], sizeof(expand_lut[k]));
+    }
+
+    for (; i < n; i++)
+    {
+        dst[i] = osd_palette[src[i] & 3];
+    }
+}
+
+/**
+ * render_target_expand: copy rectangle of a target as RGBA pixels.
+ * Called by backends to present the frame.
+ *
+ * @param       rt              source target
+ * @param       r               rectangle, must be inside the target
+ * @param       dst             destination of the top left pixel of the rectangle
+ * @param       dst_stride      bytes between destination rows, negative for bottom-up
+ */
+void render_target_expand(const struct render_target *rt, const struct clip_rect *r, void *dst, int dst_stride)
+{
+    int n = r->x1 - r->x0 + 1;
+
+    if (rt->format == PIXEL_FORMAT_I8 && !expand_lut_ready)
+    {
+        build_expand_lut();
+    }
+
+    for (int y = r->y0; y <= r->y1; y++, dst = (uint8_t*)dst + dst_stride)
+    {
+        const uint8_t *src = rt->base + rt->stride * y;
+
+        if (rt->format == PIXEL_FORMAT_I8)
+        {
+            expand_span(dst, src + r->x0, n);
+        } else {
+            memcpy(dst, src + r->x0 * 4, n * 4);
+        }
+    }
+}
+
+// Convert a RGBA pixel to a 16 bit format, channels are truncated
+static inline uint16_t pack_pixel16(uint32_t c, pixel_format_t format)
+{
+    uint32_t r = c & 0xff, g = (c >> 8) & 0xff, b = (c >> 16) & 0xff, a = c >> 24;
+
+    if (format == PIXEL_FORMAT_ARGB1555)
+    {
+        return (a >> 7) << 15 | (r >> 3) << 10 | (g >> 3) << 5 | b >> 3;
+    }
+    return (a >> 4) << 12 | (r >> 4) << 8 | (g >> 4) << 4 | b >> 4;
+}
+
+// 16 bit pixels of every combination of four palette indices
+static uint16_t pack_lut[256][4];
+static int pack_lut_format = -1;
+
+static void build_pack_lut(pixel_format_t format)
+{
+    for (int k = 0; k < 256; k++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            pack_lut[k][i] = pack_pixel16(osd_palette[(k >> (2 * i)) & 3], format);
+        }
+    }
+    pack_lut_format = format;
+}
+
+static inline void pack_span(uint16_t *dst, const uint8_t *src, int n, pixel_format_t format)
+{
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        int k = (src[i] & 3) | (src[i + 1] & 3) << 2 | (src[i + 2] & 3) << 4 | (src[i + 3] & 3) << 6;
+        memcpy(dst + i, pack_lut[k], sizeof(pack_lut[k]));
+    }
+
+    for (; i < n; i++)
+    {
+        dst[i] = pack_pixel16(osd_palette[src[i] & 3], format);
+    }
+}
+
+/**
+ * render_target_pack: copy rectangle of a target in a presentation format.
+ * Like render_target_expand, but can also produce 16 bit pixels for
+ * planes with less bandwidth.
+ *
+ * @param       rt              source target
+ * @param       r               rectangle, must be inside the target
+ * @param       dst             destination of the top left pixel of the rectangle
+ * @param       dst_stride      bytes between destination rows, negative for bottom-up
+ * @param       dst_format      PIXEL_FORMAT_RGBA32, PIXEL_FORMAT_ARGB1555 or PIXEL_FORMAT_ARGB4444
+ */
+void render_target_pack(const struct render_target *rt, const struct clip_rect *r, void *dst, int dst_stride,
+                        pixel_format_t dst_format)
+{
+    int n = r->x1 - r->x0 + 1;
+
+    if (dst_format == PIXEL_FORMAT_RGBA32)
+    {
+        render_target_expand(rt, r, dst, dst_stride);
+        return;
+    }
+
+    if (rt->format == PIXEL_FORMAT_I8 && pack_lut_format != dst_format)
+    {
+        build_pack_lut(dst_format);
+    }
+
+    for (int y = r->y0; y <= r->y1; y++, dst = (uint8_t*)dst + dst_stride)
+    {
+        const uint8_t *src = rt->base + rt->stride * y;
+
+        if (rt->format == PIXEL_FORMAT_I8)
+        {
+            pack_span(dst, src + r->x0, n, dst_format);
+        } else {
+            const uint32_t *src32 = (const uint32_t*)src + r->x0;
+            for (int i = 0; i < n; i++)
+            {
+                ((uint16_t*)dst)[i] = pack_pixel16(src32[i], dst_format);
+            }
+        }
+    }
+}
+
+/**
+ * palette_fits_format: check if a presentation format shows the palette
+ * without visible loss. Colors lose low bits in 16 bit formats, but
+ * ARGB1555 can only show fully opaque or transparent pixels.
+ *
+ * @param       format  presentation format
+ * @return      1 if the palette can be shown in this format
+ */
+int palette_fits_format(pixel_format_t format)
+{
+    if (format != PIXEL_FORMAT_ARGB1555)
+    {
+        return 1;
+    }
+
+    for (int i = 0; i < PALETTE_SIZE; i++)
+    {
+        uint32_t a = osd_palette[i] >> 24;
+        if (a != 0 && a != 0xff)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * set_palette: set colors from a string.
+ *
+ * @param       spec    black, main and warn color, comma separated
+ *                      RRGGBB or RRGGBBAA hex values
+ * @return      0 on success, -1 if the string is invalid
+ */
+int set_palette(const char *spec)
+{
+    uint32_t colors[PALETTE_SIZE - 1];
+
+    for (int i = 0; i < PALETTE_SIZE - 1; i++)
+    {
+        char *end;
+        unsigned long v = strtoul(spec, &end, 16);
+        int digits = end - spec;
+
+        if ((digits != 6 && digits != 8) || *end != (i < PALETTE_SIZE - 2 ? ',' : '\0'))
+        {
+            return -1;
+        }
+        if (digits == 6)
+        {
+            v = (v << 8) | 0xff;
+        }
+        // RRGGBBAA to memory order R, G, B, A
+        colors[i] = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+        spec = end + 1;
+    }
+
+    memcpy(osd_palette + 1, colors, sizeof(colors));
+    expand_lut_ready = 0;
+    pack_lut_format = -1;
+    return 0;
+}
+
+/**
+ * render_target_init: describe a memory area as a render target.
+ * Clip rectangle is set to the whole target.
+ *
+ * @param       rt      target to initialize
+ * @param       base    pointer to the first byte of the top row
+ * @param       stride  bytes between two rows, negative for bottom-up buffers
+ * @param       width   width in pixels
+ * @param       height  height in pixels
+ * @param       format  pixel format
+ */
+void render_target_init(struct render_target *rt, void *base, int stride, int width, int height, pixel_format_t format)
+{
+    rt->base = base;
+    rt->stride = stride;
+    rt->width = width;
+    rt->height = height;
+    rt->format = format;
+    rt->drawn = NULL;
+    rt->clip_depth = 0;
+    render_target_set_clip(rt, 0, 0, width - 1, height - 1);
+}
+
+/**
+ * render_target_set_clip: limit drawing to a rectangle.
+ * The rectangle is intersected with the target bounds.
+ *
+ * @param       rt      render target
+ * @param       x0, y0  top left corner (inclusive)
+ * @param       x1, y1  bottom right corner (inclusive)
+ */
+void render_target_set_clip(struct render_target *rt, int x0, int y0, int x1, int y1)
+{
+    rt->clip.x0 = MAX(x0, 0);
+    rt->clip.y0 = MAX(y0, 0);
+    rt->clip.x1 = MIN(x1, rt->width - 1);
+    rt->clip.y1 = MIN(y1, rt->height - 1);
+}
+
+/**
+ * set_render_target: select target for all following write_* calls.
+ *
+ * @param       rt      new render target
+ * @return      previous render target
+ */
+struct render_target* set_render_target(struct render_target *rt)
+{
+    struct render_target *prev = draw_target;
+    draw_target = rt;
+    return prev;
+}
+
+/**
+ * push_clip_rect: limit drawing of the current target to a rectangle.
+ * The rectangle is intersected with the current clip, which is restored
+ * by the matching pop_clip_rect.
+ *
+ * @param       x0, y0  top left corner (inclusive)
+ * @param       x1, y1  bottom right corner (inclusive)
+ */
+void push_clip_rect(int x0, int y0, int x1, int y1)
+{
+    struct render_target *rt = draw_target;
+
+    // Replayed by every band, commands inside may reach any row
+    if (dl_recording)
+    {
+        dl_append(dl_recording, DL_PUSH_CLIP, INT16_MIN, INT16_MAX, NULL, 0, 4, x0, y0, x1, y1);
+    }
+
+    assert(rt->clip_depth < CLIP_STACK_DEPTH);
+    rt->clip_stack[rt->clip_depth++] = rt->clip;
+    rt->clip.x0 = MAX(rt->clip.x0, x0);
+    rt->clip.y0 = MAX(rt->clip.y0, y0);
+    rt->clip.x1 = MIN(rt->clip.x1, x1);
+    rt->clip.y1 = MIN(rt->clip.y1, y1);
+}
+
+/**
+ * pop_clip_rect: restore clip rectangle saved by push_clip_rect.
+ */
+void pop_clip_rect(void)
+{
+    struct render_target *rt = draw_target;
+
+    if (dl_recording)
+    {
+        dl_append(dl_recording, DL_POP_CLIP, INT16_MIN, INT16_MAX, NULL, 0, 0);
+    }
+
+    assert(rt->clip_depth > 0);
+    rt->clip = rt->clip_stack[--rt->clip_depth];
+}
+
+/**
+ * render_target_clear: make damaged area of a target transparent.
+ *
+ * @param       rt      render target
+ * @param       dm      damage map, NULL to clear the whole target
+ */
+void render_target_clear(struct render_target *rt, const struct damage_map *dm)
+{
+    struct clip_rect rects[DAMAGE_MAX_RECTS];
+    int n;
+
+    if (dm == NULL)
+    {
+        rects[0].x0 = 0;
+        rects[0].y0 = 0;
+        rects[0].x1 = rt->width - 1;
+        rects[0].y1 = rt->height - 1;
+        n = 1;
+    } else {
+        n = damage_map_to_rects(dm, rects, DAMAGE_MAX_RECTS);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int x0 = MAX(rects[i].x0, 0);
+        int x1 = MIN(rects[i].x1, rt->width - 1);
+        int y1 = MIN(rects[i].y1, rt->height - 1);
+
+        if (x0 > x1) continue;
+
+        for (int y = MAX(rects[i].y0, 0); y <= y1; y++)
+        {
+            memset(rt->base + rt->stride * y + x0 * sizeof(pixel_t), '\0', (x1 - x0 + 1) * sizeof(pixel_t));
+        }
+    }
+}
+
+// Bit mask of tile columns c0 .. c1
+static inline uint64_t damage_cols_mask(int c0, int c1)
+{
+    return (~0ull >> (63 - c1)) & (~0ull << c0);
+}
+
+// Mark tiles covered by rectangle, coordinates must be inside the map
+static inline void damage_mark(struct damage_map *dm, int x0, int y0, int x1, int y1)
+{
+    uint64_t bits = damage_cols_mask(x0 / DAMAGE_TILE_WIDTH, x1 / DAMAGE_TILE_WIDTH);
+
+    for (int r = y0 / DAMAGE_TILE_HEIGHT; r <= y1 / DAMAGE_TILE_HEIGHT; r++)
+    {
+        dm->tiles[r] |= bits;
+    }
+}
+
+/**
+ * damage_map_init: setup empty damage map for area of given size.
+ *
+ * @param       dm      damage map
+ * @param       width   area width in pixels
+ * @param       height  area height in pixels
+ */
+void damage_map_init(struct damage_map *dm, int width, int height)
+{
+    dm->width = width;
+    dm->height = height;
+    dm->cols = (width + DAMAGE_TILE_WIDTH - 1) / DAMAGE_TILE_WIDTH;
+    dm->rows = (height + DAMAGE_TILE_HEIGHT - 1) / DAMAGE_TILE_HEIGHT;
+
+    assert(dm->cols <= DAMAGE_MAX_COLS && dm->rows <= DAMAGE_MAX_ROWS);
+    damage_map_clear(dm);
+}
+
+void damage_map_clear(struct damage_map *dm)
+{
+    memset(dm->tiles, '\0', sizeof(dm->tiles));
+}
+
+void damage_map_fill(struct damage_map *dm)
+{
+    for (int r = 0; r < dm->rows; r++)
+    {
+        dm->tiles[r] = damage_cols_mask(0, dm->cols - 1);
+    }
+}
+
+/**
+ * damage_map_add_rect: mark rectangle as damaged.
+ * Rectangle is clipped to the map area.
+ *
+ * @param       dm      damage map
+ * @param       x0, y0  top left corner (inclusive)
+ * @param       x1, y1  bottom right corner (inclusive)
+ */
+void damage_map_add_rect(struct damage_map *dm, int x0, int y0, int x1, int y1)
+{
+    x0 = MAX(x0, 0);
+    y0 = MAX(y0, 0);
+    x1 = MIN(x1, dm->width - 1);
+    y1 = MIN(y1, dm->height - 1);
+
+    if (x0 > x1 || y0 > y1) return;
+
+    damage_mark(dm, x0, y0, x1, y1);
+}
+
+void damage_map_merge(struct damage_map *dst, const struct damage_map *src)
+{
+    for (int r = 0; r < dst->rows; r++)
+    {
+        dst->tiles[r] |= src->tiles[r];
+    }
+}
+
+int damage_map_empty(const struct damage_map *dm)
+{
+    for (int r = 0; r < dm->rows; r++)
+    {
+        if (dm->tiles[r]) return 0;
+    }
+    return 1;
+}
+
+/**
+ * damage_map_to_rects: convert damage map to list of rectangles.
+ * Runs of tiles in a row are joined and stacked equal runs are merged.
+ * If the list is too short the last rectangle grows to cover the rest.
+ *
+ * @param       dm              damage map
+ * @param       rects           output rectangles, clipped to the map area
+ * @param       max_rects       size of rects
+ * @return      number of rectangles
+ */
+int damage_map_to_rects(const struct damage_map *dm, struct clip_rect *rects, int max_rects)
+{
+    int n = 0;
+
+    for (int r = 0; r < dm->rows; r++)
+    {
+        uint64_t bits = dm->tiles[r];
+        int c = 0;
+
+        while (bits)
+        {
+            while (!(bits & 1))
+            {
+                bits >>= 1;
+                c++;
+            }
+
+            int c0 = c;
+            while (bits & 1)
+            {
+                bits >>= 1;
+                c++;
+            }
+
+            struct clip_rect rect = {
+                .x0 = c0 * DAMAGE_TILE_WIDTH,
+                .y0 = r * DAMAGE_TILE_HEIGHT,
+                .x1 = MIN(c * DAMAGE_TILE_WIDTH, dm->width) - 1,
+                .y1 = MIN((r + 1) * DAMAGE_TILE_HEIGHT, dm->height) - 1,
+            };
+            int merged = 0;
+
+            // Extend rectangle with the same run from previous rows
+            for (int i = 0; i < n; i++)
+            {
+                if (rects[i].x0 == rect.x0 && rects[i].x1 == rect.x1 && rects[i].y1 == rect.y0 - 1)
+                {
+                    rects[i].y1 = rect.y1;
+                    merged = 1;
+                    break;
+                }
+            }
+
+            if (merged) continue;
+
+            if (n < max_rects)
+            {
+                rects[n++] = rect;
+            } else {
+                struct clip_rect *last = &rects[max_rects - 1];
+                last->x0 = MIN(last->x0, rect.x0);
+                last->y0 = MIN(last->y0, rect.y0);
+                last->x1 = MAX(last->x1, rect.x1);
+                last->y1 = MAX(last->y1, rect.y1);
+            }
+        }
+    }
+
+    return n;
+}
+
+static inline pixel_t* pixel_ptr(int x, int y)
+{
+    return (pixel_t*)(draw_target->base + draw_target->stride * y) + x;
+}
+
+// Track area touched by drawing, coordinates must be clipped
+static inline void mark_drawn(int x0, int y0, int x1, int y1)
+{
+    if (draw_target->drawn != NULL)
+    {
+        damage_mark(draw_target->drawn, x0, y0, x1, y1);
+    }
+}
+
+/**
+ * fill_span: fill a horizontal run of pixels with a packed value.
+ * Coordinates must be already clipped.
+ *
+ * @param       ptr     pointer to the first pixel
+ * @param       n       number of pixels
+ * @param       value   packed pixel value
+ */
+static inline void fill_span(pixel_t *ptr, int n, pixel_t value)
+{
+#ifndef OSD_RGBA_BUFFER
+    memset(ptr, value, n);
+#else
+    if (value == 0)
+    {
+        memset(ptr, '\0', n * sizeof(uint32_t));
+        return;
+    }
 
+    // Align to 8 bytes and write two pixels per store
+    if (((uintptr_t)ptr & 7) && n > 0)
+    {
+        *ptr++ = value;
+        n--;
+    }
 
-#ifdef __DRM_ROCKCHIP__
+    uint64_t value2 = ((uint64_t)value << 32) | value;
+    uint64_t *ptr2 = (uint64_t*)ptr;
 
-int drm_init(void);
-void drm_cleanup(void);
-void drm_display_buffer(void *src_buf);
+    for (; n >= 8; n -= 8)
+    {
+        ptr2[0] = value2;
+        ptr2[1] = value2;
+        ptr2[2] = value2;
+        ptr2[3] = value2;
+        ptr2 += 4;
+    }
 
-void render_init(int shift_x, int shift_y, float scale_x, float scale_y)
-{
-    if(drm_init() != 0)
+    for (; n >= 2; n -= 2)
     {
-        exit(1);
+        *ptr2++ = value2;
     }
-    atexit(drm_cleanup);
-    video_buf_int = malloc(GRAPHICS_WIDTH * GRAPHICS_HEIGHT * 4);
-}
 
-void clearGraphics(void)
-{
-    memset(video_buf_int, '\0', GRAPHICS_WIDTH * GRAPHICS_HEIGHT * 4);
+    if (n)
+    {
+        *(uint32_t*)ptr2 = value;
+    }
+#endif
 }
 
-void* displayGraphics(void)
+/**
+ * fill_rect: fill a clipped rectangle with a packed value.
+ *
+ * @param       x0, y0  top left corner (inclusive)
+ * @param       x1, y1  bottom right corner (inclusive)
+ * @param       value   packed pixel value
+ */
+static void fill_rect(int x0, int y0, int x1, int y1, pixel_t value)
 {
-    drm_display_buffer(video_buf_int);
-    return NULL;
-}
+    const struct clip_rect *clip = &draw_target->clip;
 
-#endif
+    if (x0 < clip->x0) x0 = clip->x0;
+    if (x1 > clip->x1) x1 = clip->x1;
+    if (y0 < clip->y0) y0 = clip->y0;
+    if (y1 > clip->y1) y1 = clip->y1;
 
+    if (x0 > x1 || y0 > y1) return;
 
-void* render(void)
-{
-    clearGraphics();
-    RenderScreen();
-    return displayGraphics();
-}
+    mark_drawn(x0, y0, x1, y1);
 
-//void drawArrow(uint16_t x, uint16_t y, uint16_t angle, uint16_t size_quarter)
-//{
-//	float sin_angle = sin_lookup_deg(angle);
-//	float cos_angle = cos_lookup_deg(angle);
-//	int16_t peak_x  = (int16_t)(sin_angle * size_quarter * 2);
-//	int16_t peak_y  = (int16_t)(cos_angle * size_quarter * 2);
-//	int16_t d_end_x = (int16_t)(cos_angle * size_quarter);
-//	int16_t d_end_y = (int16_t)(sin_angle * size_quarter);
+    int n = x1 - x0 + 1;
+    pixel_t *ptr = pixel_ptr(x0, y0);
 
-//	write_line_lm(x + peak_x, y - peak_y, x - peak_x - d_end_x, y + peak_y - d_end_y, 1, 1);
-//	write_line_lm(x + peak_x, y - peak_y, x - peak_x + d_end_x, y + peak_y + d_end_y, 1, 1);
-//	write_line_lm(x, y, x - peak_x - d_end_x, y + peak_y - d_end_y, 1, 1);
-//	write_line_lm(x, y, x - peak_x + d_end_x, y + peak_y + d_end_y, 1, 1);
-//}
+    if (n == 1)
+    {
+        for (int y = y0; y <= y1; y++, ptr = (pixel_t*)((uint8_t*)ptr + draw_target->stride)) *ptr = value;
+        return;
+    }
 
-void drawBox(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2) {
-  write_line_lm(x1, y1, x2, y1, 1, 1);       // top
-  write_line_lm(x1, y1, x1, y2, 1, 1);       // left
-  write_line_lm(x2, y1, x2, y2, 1, 1);       // right
-  write_line_lm(x1, y2, x2, y2, 1, 1);       // bottom
+    for (int y = y0; y <= y1; y++, ptr = (pixel_t*)((uint8_t*)ptr + draw_target->stride))
+    {
+        fill_span(ptr, n, value);
+    }
 }
 
 /**
@@ -212,37 +1406,13 @@ void drawBox(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2) {
  * @param       color   0 = black, 1 = main, 2 = warn
  */
 void inline write_pixel_lm(int x, int y, int opaq, int color){
-    CHECK_COORDS(x, y);
-    assert((opaq == 0 || opaq == 1) && (color >= 0 && color <= 2));
-
-#ifdef __BCM_OPENVG__
-    uint32_t *ptr = ((uint32_t*)video_buf_int) + GRAPHICS_WIDTH * (GRAPHICS_HEIGHT - y - 1) + x;
-#else
-    uint32_t *ptr = ((uint32_t*)video_buf_int) + GRAPHICS_WIDTH * (y) + x;
-#endif
-
-    if (opaq == 0){
-      *ptr = 0u;
-      return;
-    }
-
-    // BE: ABGR
-    // LE: RGBA
-
-    switch(color)
-    {
-    case 0: //black
-        *ptr = 0xff000000u;
-        break;
-
-    case 1: // monochrome crt green
-        *ptr = 0xff41ff00u;
-        break;
-
-    case 2: // amber
-      *ptr = 0xff0000ffu;
-      break;
+    if (dl_recording) {
+        dl_append(dl_recording, DL_PIXEL, y, y, NULL, 0, 4, x, y, opaq, color);
+        return;
     }
+    CHECK_COORDS(x, y);
+    mark_drawn(x, y, x, y);
+    *pixel_ptr(x, y) = pack_color(opaq, color);
 }
 
 
@@ -256,9 +1426,12 @@ void inline write_pixel_lm(int x, int y, int opaq, int color){
  * @param       opaq   0 = transparent, 1 = opaque
  */
 void write_hline_lm(int x0, int x1, int y, int color, int opaq) {
-    int x;
+    if (dl_recording) {
+        dl_append(dl_recording, DL_HLINE, y, y, NULL, 0, 5, x0, x1, y, color, opaq);
+        return;
+    }
     if (x1 < x0) SWAP(x0, x1);
-    for(x = x0; x <= x1; x++) write_pixel_lm(x, y, opaq, color);
+    fill_rect(x0, y, x1, y, pack_color(opaq, color));
 }
 
 /**
@@ -276,6 +1449,11 @@ void write_hline_lm(int x0, int x1, int y, int color, int opaq) {
 void write_hline_outlined(int x0, int x1, int y, int endcap0, int endcap1, int mode, int opaq, int color) {
   int stroke, fill;
 
+  if (dl_recording) {
+    dl_append(dl_recording, DL_HLINE_OUTLINED, y - 1, y + 1, NULL, 0, 8, x0, x1, y, endcap0, endcap1, mode, opaq, color);
+    return;
+  }
+
   SETUP_STROKE_FILL(stroke, fill, mode);
   if (x0 > x1) {
     SWAP(x0, x1);
@@ -300,11 +1478,12 @@ void write_hline_outlined(int x0, int x1, int y, int endcap0, int endcap1, int m
  * @param       opaq   0 = transparent, 1 = opaque
  */
 void write_vline_lm(int x, int y0, int y1, int color, int opaq) {
-    // TODO: an optimisation would compute the masks and apply to
-    // both buffers simultaneously.
-    int y;
+    if (dl_recording) {
+        dl_append(dl_recording, DL_VLINE, MIN(y0, y1), MAX(y0, y1), NULL, 0, 5, x, y0, y1, color, opaq);
+        return;
+    }
     if (y1 < y0) SWAP(y0, y1);
-    for(y = y0; y <= y1; y++) write_pixel_lm(x, y, opaq, color);
+    fill_rect(x, y0, x, y1, pack_color(opaq, color));
 }
 
 /**
@@ -322,6 +1501,11 @@ void write_vline_lm(int x, int y0, int y1, int color, int opaq) {
 void write_vline_outlined(int x, int y0, int y1, int endcap0, int endcap1, int mode, int opaq, int color) {
   int stroke, fill;
 
+  if (dl_recording) {
+    dl_append(dl_recording, DL_VLINE_OUTLINED, MIN(y0, y1) - 1, MAX(y0, y1) + 1, NULL, 0, 8, x, y0, y1, endcap0, endcap1, mode, opaq, color);
+    return;
+  }
+
   if (y0 > y1) {
     SWAP(y0, y1);
   }
@@ -347,14 +1531,11 @@ void write_vline_outlined(int x, int y0, int y1, int endcap0, int endcap1, int m
  * @param       opaq   0 = transparent, 1 = opaque
  */
 void write_filled_rectangle_lm(int x, int y, int width, int height, int color, int opaq) {
-    int i, j;
-    for(j=y; j <= y + height; j++)
-    {
-        for(i=x; i <= x + width; i++)
-        {
-            write_pixel_lm(i, j, opaq, color);
-        }
+    if (dl_recording) {
+        dl_append(dl_recording, DL_FILLED_RECT, y, y + height, NULL, 0, 6, x, y, width, height, color, opaq);
+        return;
     }
+    fill_rect(x, y, x + width, y + height, pack_color(opaq, color));
 }
 
 /**
@@ -376,6 +1557,148 @@ void write_rectangle_outlined(int x, int y, int width, int height, int mode, int
 }
 
 
+// Circles are drawn from per-radius tables of horizontal runs, each pixel
+// being either outline or body. Tables are built and cached at record
+// time, lookups while rasterizing never modify the cache.
+
+#define CIRCLE_CACHE_SIZE 16
+
+#define CIRCLE_RUN_STROKE 1
+#define CIRCLE_RUN_FILL   2
+
+struct circle_run
+{
+    int16_t dy, x0, x1;         // offsets from the center
+    uint8_t kind;
+};
+
+struct circle_spans
+{
+    int r, dashp, bmode;
+    unsigned int last_used;     // frame that used the table last, 0 if empty
+    int count;
+    struct circle_run *runs;
+};
+
+static struct circle_spans circle_cache[CIRCLE_CACHE_SIZE];
+
+// Same pixels as the midpoint algorithm with 8-fold symmetric plots
+#define CIRCLE_GRID_PLOT_4(x, y, k)                     \
+    grid[((y) + c) * size + (x) + c] = k;               \
+    grid[((y) + c) * size - (x) + c] = k;               \
+    grid[(c - (y)) * size + (x) + c] = k;               \
+    grid[(c - (y)) * size - (x) + c] = k;
+
+#define CIRCLE_GRID_PLOT_8(x, y, k)                     \
+    CIRCLE_GRID_PLOT_4(x, y, k);                        \
+    if ((x) != (y)) { CIRCLE_GRID_PLOT_4(y, x, k); }
+
+static void build_circle_spans(struct circle_spans *cs, int r, int dashp, int bmode)
+{
+    // outline reaches r + 1 pixels from the center
+    int c = r + 2, size = 2 * c + 1;
+    uint8_t *grid = calloc(size * size, 1);
+    assert(grid != NULL);
+
+    // Outline first, then the body over it
+    int error = -r, x = r, y = 0;
+    while (x >= y) {
+      if (dashp == 0 || (y % dashp) < (dashp / 2)) {
+        CIRCLE_GRID_PLOT_8(x + 1, y, CIRCLE_RUN_STROKE);
+        CIRCLE_GRID_PLOT_8(x, y + 1, CIRCLE_RUN_STROKE);
+        CIRCLE_GRID_PLOT_8(x - 1, y, CIRCLE_RUN_STROKE);
+        CIRCLE_GRID_PLOT_8(x, y - 1, CIRCLE_RUN_STROKE);
+
+        if (bmode == 1) {
+          CIRCLE_GRID_PLOT_8(x + 1, y + 1, CIRCLE_RUN_STROKE);
+          CIRCLE_GRID_PLOT_8(x - 1, y - 1, CIRCLE_RUN_STROKE);
+        }
+      }
+      error += (y * 2) + 1;
+      y++;
+      if (error >= 0) {
+        --x;
+        error -= x * 2;
+      }
+    }
+    error = -r;
+    x     = r;
+    y     = 0;
+    while (x >= y) {
+      if (dashp == 0 || (y % dashp) < (dashp / 2)) {
+        CIRCLE_GRID_PLOT_8(x, y, CIRCLE_RUN_FILL);
+      }
+      error += (y * 2) + 1;
+      y++;
+      if (error >= 0) {
+        --x;
+        error -= x * 2;
+      }
+    }
+
+    // Runs of equal pixels
+    int capacity = 0;
+    cs->r = r;
+    cs->dashp = dashp;
+    cs->bmode = bmode;
+    cs->count = 0;
+
+    for (int gy = 0; gy < size; gy++) {
+      const uint8_t *row = grid + gy * size;
+      for (int gx = 0; gx < size; ) {
+        if (row[gx] == 0) {
+          gx++;
+          continue;
+        }
+        int start = gx;
+        while (gx < size && row[gx] == row[start]) gx++;
+
+        if (cs->count == capacity) {
+          capacity = capacity ? capacity * 2 : 64;
+          cs->runs = realloc(cs->runs, capacity * sizeof(struct circle_run));
+          assert(cs->runs != NULL);
+        }
+        struct circle_run *run = &cs->runs[cs->count++];
+        run->dy = gy - c;
+        run->x0 = start - c;
+        run->x1 = gx - 1 - c;
+        run->kind = row[start];
+      }
+    }
+    free(grid);
+}
+
+static const struct circle_spans* find_circle_spans(int r, int dashp, int bmode)
+{
+    for (int i = 0; i < CIRCLE_CACHE_SIZE; i++) {
+        struct circle_spans *cs = &circle_cache[i];
+        if (cs->last_used && cs->r == r && cs->dashp == dashp && cs->bmode == bmode) {
+            return cs;
+        }
+    }
+    return NULL;
+}
+
+// Make sure the table is cached, least recently used one is replaced
+static void cache_circle_spans(int r, int dashp, int bmode)
+{
+    struct circle_spans *cs = (struct circle_spans*)find_circle_spans(r, dashp, bmode);
+
+    if (cs == NULL) {
+        for (int i = 0; i < CIRCLE_CACHE_SIZE; i++) {
+            if (cs == NULL || circle_cache[i].last_used < cs->last_used) {
+                cs = &circle_cache[i];
+            }
+        }
+        // Tables of the current frame are kept, rasterizer builds a temporary one
+        if (cs->last_used == circle_frame) {
+            return;
+        }
+        build_circle_spans(cs, r, dashp, bmode);
+    }
+    cs->last_used = circle_frame;
+}
+
 /**
  * write_circle_outlined: draw an outlined circle on the draw buffer.
  *
@@ -388,46 +1711,41 @@ void write_rectangle_outlined(int x, int y, int width, int height, int mode, int
  * @param       opaq   0 = transparent, 1 = opaque
  */
 void write_circle_outlined(int cx, int cy, int r, int dashp, int bmode, int mode, int opaq, int color) {
+  // Circles are drawn only if the center is on the target, checked against
+  // its bounds rather than the clip so a band of the target draws its part.
+  // Larger radius than the target size leaves nothing visible.
+  if (cx < 0 || cx >= draw_target->width || cy < 0 || cy >= draw_target->height ||
+      r < 0 || r > draw_target->width + draw_target->height) {
+    return;
+  }
+
+  if (dl_recording) {
+    cache_circle_spans(r, dashp, bmode);
+    dl_append(dl_recording, DL_CIRCLE, cy - r - 2, cy + r + 2, NULL, 0, 8, cx, cy, r, dashp, bmode, mode, opaq, color);
+    return;
+  }
+
   int stroke, fill;
+  struct circle_spans tmp = { 0 };
+  const struct circle_spans *cs = find_circle_spans(r, dashp, bmode);
 
-  CHECK_COORDS(cx, cy);
-  SETUP_STROKE_FILL(stroke, fill, mode);
-  // This is a two step procedure. First, we draw the outline of the
-  // circle, then we draw the inner part.
-  int error = -r, x = r, y = 0;
-  while (x >= y) {
-    if (dashp == 0 || (y % dashp) < (dashp / 2)) {
-        CIRCLE_PLOT_8(cx, cy, x + 1, y, opaq, stroke);
-        CIRCLE_PLOT_8(cx, cy, x, y + 1, opaq, stroke);
-        CIRCLE_PLOT_8(cx, cy, x - 1, y, opaq, stroke);
-        CIRCLE_PLOT_8(cx, cy, x, y - 1, opaq, stroke);
-
-      if (bmode == 1) {
-          CIRCLE_PLOT_8(cx, cy, x + 1, y + 1, opaq, stroke);
-          CIRCLE_PLOT_8(cx, cy, x - 1, y - 1, opaq, stroke);
-      }
-    }
-    error += (y * 2) + 1;
-    y++;
-    if (error >= 0) {
-      --x;
-      error -= x * 2;
-    }
+  if (cs == NULL) {
+    build_circle_spans(&tmp, r, dashp, bmode);
+    cs = &tmp;
   }
-  error = -r;
-  x     = r;
-  y     = 0;
-  while (x >= y) {
-    if (dashp == 0 || (y % dashp) < (dashp / 2)) {
-        CIRCLE_PLOT_8(cx, cy, x, y, opaq, fill);
-    }
-    error += (y * 2) + 1;
-    y++;
-    if (error >= 0) {
-      --x;
-      error -= x * 2;
-    }
+
+  SETUP_STROKE_FILL(stroke, fill, mode);
+  const pixel_t value[3] = { 0, pack_color(opaq, stroke), pack_color(opaq, fill) };
+
+  for (int i = 0; i < cs->count; i++) {
+    const struct circle_run *run = &cs->runs[i];
+    int y = cy + run->dy;
+
+    if (y < draw_target->clip.y0 || y > draw_target->clip.y1) continue;
+    fill_rect(cx + run->x0, y, cx + run->x1, y, value[run->kind]);
   }
+
+  free(tmp.runs);
 }
 
 
@@ -443,6 +1761,27 @@ void write_circle_outlined(int cx, int cy, int r, int dashp, int bmode, int mode
  * @param       color  0 = black, 1 = main, 2 = warn
  */
 void write_line_lm(int x0, int y0, int x1, int y1, int opaq, int color) {
+  if (dl_recording) {
+    dl_append(dl_recording, DL_LINE, MIN(y0, y1), MAX(y0, y1), NULL, 0, 6, x0, y0, x1, y1, opaq, color);
+    return;
+  }
+
+  // Lines completely outside of the clip are skipped, completely
+  // inside ones are drawn without checking each pixel
+  const struct clip_rect *clip = &draw_target->clip;
+  int bx0 = MIN(x0, x1), bx1 = MAX(x0, x1);
+  int by0 = MIN(y0, y1), by1 = MAX(y0, y1);
+
+  if (bx1 < clip->x0 || bx0 > clip->x1 || by1 < clip->y0 || by0 > clip->y1) {
+    return;
+  }
+  int inside = bx0 >= clip->x0 && bx1 <= clip->x1 && by0 >= clip->y0 && by1 <= clip->y1;
+  pixel_t value = pack_color(opaq, color);
+
+  if (inside) {
+    mark_drawn(bx0, by0, bx1, by1);
+  }
+
   // Based on http://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
   int steep = abs(y1 - y0) > abs(x1 - x0);
 
@@ -466,7 +1805,9 @@ void write_line_lm(int x0, int y0, int x1, int y1, int opaq, int color) {
     ystep = -1;
   }
   for (x = x0; x <= x1; x++) {
-    if (steep) {
+    if (inside) {
+        *(steep ? pixel_ptr(y, x) : pixel_ptr(x, y)) = value;
+    } else if (steep) {
         write_pixel_lm(y, x, opaq, color);
     } else {
         write_pixel_lm(x, y, opaq, color);
@@ -480,6 +1821,114 @@ void write_line_lm(int x0, int y0, int x1, int y1, int opaq, int color) {
 }
 
 
+// Number of minor axis steps Bresenham makes before column k
+static inline int line_steps(int k, int deltax, int deltay)
+{
+  int num = k * deltay - deltax / 2;
+  return num > 0 ? (num + deltax - 1) / deltax : 0;
+}
+
+/**
+ * write_line_outlined_spans: single pass outlined line.
+ * Produces the same pixels as drawing the 4-neighbour outline of each
+ * Bresenham pixel and then the body over it, but writes each pixel once:
+ * every column gets outline, body, outline across the minor axis and the
+ * end columns get one outline pixel. In gaps of a dashed line the body
+ * pixel is only set if an adjacent column's outline covers it.
+ * The line is clipped against the clip rectangle once.
+ *
+ * @param       x0, y0, x1, y1  line coordinates
+ * @param       omode           outline color
+ * @param       imode           body color
+ * @param       opaq            0 = transparent, 1 = opaque
+ * @param       dots            0 = solid, > 0 = # of set/unset dots for the dashed innards
+ */
+static void write_line_outlined_spans(int x0, int y0, int x1, int y1, int omode, int imode, int opaq, int dots)
+{
+  // Based on http://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
+  int steep = abs(y1 - y0) > abs(x1 - x0);
+  if (steep) {
+    SWAP(x0, y0);
+    SWAP(x1, y1);
+  }
+  if (x0 > x1) {
+    SWAP(x0, x1);
+    SWAP(y0, y1);
+  }
+  int deltax = x1 - x0;
+  int deltay = abs(y1 - y0);
+  int ystep = y0 < y1 ? 1 : -1;
+  pixel_t ovalue = pack_color(opaq, omode);
+  pixel_t ivalue = pack_color(opaq, imode);
+
+  // Clip rectangle in major/minor axis space
+  const struct clip_rect *clip = &draw_target->clip;
+  int maj0 = steep ? clip->y0 : clip->x0;
+  int maj1 = steep ? clip->y1 : clip->x1;
+  int min0 = steep ? clip->x0 : clip->y0;
+  int min1 = steep ? clip->x1 : clip->y1;
+
+  // Bounding box of the outline
+  int ymin = MIN(y0, y1) - 1;
+  int ymax = MAX(y0, y1) + 1;
+  if (x0 - 1 > maj1 || x1 + 1 < maj0 || ymin > min1 || ymax < min0) {
+    return;
+  }
+  int inside = x0 - 1 >= maj0 && x1 + 1 <= maj1 && ymin >= min0 && ymax <= min1;
+
+  if (steep) {
+    mark_drawn(MAX(ymin, min0), MAX(x0 - 1, maj0), MIN(ymax, min1), MIN(x1 + 1, maj1));
+  } else {
+    mark_drawn(MAX(x0 - 1, maj0), MAX(ymin, min0), MIN(x1 + 1, maj1), MIN(ymax, min1));
+  }
+
+#define LINE_PUT(maj, min, value)                                       \
+  if (inside || ((min) >= min0 && (min) <= min1)) {                     \
+    if (steep) { *pixel_ptr(min, maj) = value; }                        \
+    else { *pixel_ptr(maj, min) = value; }                              \
+  }
+
+  // End columns
+  if (x0 - 1 >= maj0) {
+    LINE_PUT(x0 - 1, y0, ovalue);
+  }
+  if (x1 + 1 <= maj1) {
+    LINE_PUT(x1 + 1, y1, ovalue);
+  }
+
+  // Start from the first column inside the clip rectangle
+  int xs = MAX(x0, maj0);
+  int xe = MIN(x1, maj1);
+  int k = xs - x0;
+  int steps = deltax ? line_steps(k, deltax, deltay) : 0;
+  int error = deltax / 2 - k * deltay + steps * deltax;
+  int y = y0 + ystep * steps;
+  int yprev = k > 0 ? y0 + ystep * line_steps(k - 1, deltax, deltay) : y;
+
+  for (int x = xs; x <= xe; x++, k++) {
+    int ynext = y;
+    error -= deltay;
+    if (error < 0) {
+      ynext += ystep;
+      error += deltax;
+    }
+
+    LINE_PUT(x, y - 1, ovalue);
+    LINE_PUT(x, y + 1, ovalue);
+
+    if (dots == 0 || (k / dots) % 2) {
+      LINE_PUT(x, y, ivalue);
+    } else if ((k > 0 && yprev == y) || (x < x1 && ynext == y)) {
+      LINE_PUT(x, y, ovalue);
+    }
+
+    yprev = y;
+    y = ynext;
+  }
+
+#undef LINE_PUT
+}
+
 /**
  * write_line_outlined: Draw a line of arbitrary angle, with an outline.
  *
@@ -496,10 +1945,13 @@ void write_line_lm(int x0, int y0, int x1, int y1, int opaq, int color) {
 void write_line_outlined(int x0, int y0, int x1, int y1,
                          __attribute__((unused)) int endcap0, __attribute__((unused)) int endcap1,
                          int mode, int opaq) {
-  // Based on http://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
-  // This could be improved for speed.
   int omode, imode;
 
+  if (dl_recording) {
+    dl_append(dl_recording, DL_LINE_OUTLINED, MIN(y0, y1) - 1, MAX(y0, y1) + 1, NULL, 0, 6, x0, y0, x1, y1, mode, opaq);
+    return;
+  }
+
   switch(mode)
   {
   case 0:
@@ -518,60 +1970,7 @@ void write_line_outlined(int x0, int y0, int x1, int y1,
       assert(0);
   }
 
-  int steep = abs(y1 - y0) > abs(x1 - x0);
-  if (steep) {
-    SWAP(x0, y0);
-    SWAP(x1, y1);
-  }
-  if (x0 > x1) {
-    SWAP(x0, x1);
-    SWAP(y0, y1);
-  }
-  int deltax     = x1 - x0;
-  int deltay = abs(y1 - y0);
-  int error      = deltax / 2;
-  int ystep;
-  int y = y0;
-  int x;
-  if (y0 < y1) {
-    ystep = 1;
-  } else {
-    ystep = -1;
-  }
-  // Draw the outline.
-  for (x = x0; x <= x1; x++) {
-    if (steep) {
-      write_pixel_lm(y - 1, x, opaq, omode);
-      write_pixel_lm(y + 1, x, opaq, omode);
-      write_pixel_lm(y, x - 1, opaq, omode);
-      write_pixel_lm(y, x + 1, opaq, omode);
-    } else {
-      write_pixel_lm(x - 1, y, opaq, omode);
-      write_pixel_lm(x + 1, y, opaq, omode);
-      write_pixel_lm(x, y - 1, opaq, omode);
-      write_pixel_lm(x, y + 1, opaq, omode);
-    }
-    error -= deltay;
-    if (error < 0) {
-      y     += ystep;
-      error += deltax;
-    }
-  }
-  // Now draw the innards.
-  error = deltax / 2;
-  y     = y0;
-  for (x = x0; x <= x1; x++) {
-    if (steep) {
-      write_pixel_lm(y, x, opaq, imode);
-    } else {
-      write_pixel_lm(x, y, opaq, imode);
-    }
-    error -= deltay;
-    if (error < 0) {
-      y     += ystep;
-      error += deltax;
-    }
-  }
+  write_line_outlined_spans(x0, y0, x1, y1, omode, imode, opaq, 0);
 }
 
 
@@ -591,10 +1990,13 @@ void write_line_outlined(int x0, int y0, int x1, int y1,
 void write_line_outlined_dashed(int x0, int y0, int x1, int y1,
                                 __attribute__((unused)) int endcap0, __attribute__((unused)) int endcap1,
                                 int mode, int opaq, int dots) {
-  // Based on http://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
-  // This could be improved for speed.
   int omode, imode;
 
+  if (dl_recording) {
+    dl_append(dl_recording, DL_LINE_OUTLINED_DASHED, MIN(y0, y1) - 1, MAX(y0, y1) + 1, NULL, 0, 7, x0, y0, x1, y1, mode, opaq, dots);
+    return;
+  }
+
   if (mode == 0) {
     omode = 0;
     imode = 1;
@@ -602,74 +2004,152 @@ void write_line_outlined_dashed(int x0, int y0, int x1, int y1,
     omode = 1;
     imode = 0;
   }
-  int steep = abs(y1 - y0) > abs(x1 - x0);
-  if (steep) {
-    SWAP(x0, y0);
-    SWAP(x1, y1);
-  }
-  if (x0 > x1) {
-    SWAP(x0, x1);
-    SWAP(y0, y1);
-  }
-  int deltax = x1 - x0;
-  int deltay = abs(y1 - y0);
-  int error  = deltax / 2;
-  int ystep;
-  int y = y0;
-  int x;
-  if (y0 < y1) {
-    ystep = 1;
-  } else {
-    ystep = -1;
+
+  write_line_outlined_spans(x0, y0, x1, y1, omode, imode, opaq, dots);
+}
+
+
+void write_triangle_wire(int x0, int y0, int x1, int y1, int x2, int y2) {
+  write_line_lm(x0, y0, x1, y1, 1, 1);
+  write_line_lm(x0, y0, x2, y2, 1, 1);
+  write_line_lm(x2, y2, x1, y1, 1, 1);
+}
+
+
+// Polygon edge, x at scanline y is x0 + (y - y0) * dx / dy
+struct poly_edge
+{
+    int x0, y0;
+    int y1;                     // first row below the edge
+    int dx, dy;                 // dy > 0
+    int64_t num;                // x * dy at current scanline
+};
+
+static int floor_div(int64_t a, int64_t b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/**
+ * write_polygon_filled: fill a convex or concave polygon.
+ * Edge table scanline fill with even-odd rule, a row is sampled at its
+ * integer y, so the bottom row of the polygon is not drawn.
+ *
+ * @param       vx, vy          vertex coordinates
+ * @param       num_verts       number of vertices
+ * @param       color           0 = black, 1 = main, 2 = warn
+ * @param       opaq            0 = transparent, 1 = opaque
+ */
+void write_polygon_filled(const int *vx, const int *vy, int num_verts, int color, int opaq) {
+  struct poly_edge edges[POLYGON_MAX_VERTICES];
+  struct poly_edge *active[POLYGON_MAX_VERTICES];
+  int num_edges = 0, num_active = 0, next_edge = 0;
+  int ymin = INT32_MAX, ymax = INT32_MIN;
+
+  if (num_verts < 3) {
+    return;
   }
-  // Draw the outline.
-  for (x = x0; x <= x1; x++) {
-    if (steep) {
-      write_pixel_lm(y - 1, x, opaq, omode);
-      write_pixel_lm(y + 1, x, opaq, omode);
-      write_pixel_lm(y, x - 1, opaq, omode);
-      write_pixel_lm(y, x + 1, opaq, omode);
-    } else {
-      write_pixel_lm(x - 1, y, opaq, omode);
-      write_pixel_lm(x + 1, y, opaq, omode);
-      write_pixel_lm(x, y - 1, opaq, omode);
-      write_pixel_lm(x, y + 1, opaq, omode);
+  assert(num_verts <= POLYGON_MAX_VERTICES);
+
+  for (int i = 0; i < num_verts; i++) {
+    ymin = MIN(ymin, vy[i]);
+    ymax = MAX(ymax, vy[i]);
+  }
+
+  if (dl_recording) {
+    int32_t verts[2 * POLYGON_MAX_VERTICES];
+    for (int i = 0; i < num_verts; i++) {
+      verts[2 * i] = vx[i];
+      verts[2 * i + 1] = vy[i];
     }
-    error -= deltay;
-    if (error < 0) {
-      y     += ystep;
-      error += deltax;
+    dl_append(dl_recording, DL_POLYGON, ymin, ymax, verts, num_verts * 2 * sizeof(int32_t), 3, num_verts, color, opaq);
+    return;
+  }
+
+  // Edge table sorted by the top row, horizontal edges add no crossings
+  for (int i = 0; i < num_verts; i++) {
+    int j = (i + 1) % num_verts;
+    int a = vy[i] < vy[j] ? i : j;
+    int b = a == i ? j : i;
+
+    if (vy[a] == vy[b]) continue;
+
+    struct poly_edge e = { vx[a], vy[a], vy[b], vx[b] - vx[a], vy[b] - vy[a], 0 };
+    int k = num_edges++;
+    while (k > 0 && edges[k - 1].y0 > e.y0) {
+      edges[k] = edges[k - 1];
+      k--;
     }
+    edges[k] = e;
   }
-  // Now draw the innards.
-  error = deltax / 2;
-  y     = y0;
-  int dot_cnt = 0;
-  int draw    = 1;
-  for (x = x0; x <= x1; x++) {
-    if (dots && !(dot_cnt++ % dots)) {
-      draw++;
-    }
-    if (draw % 2) {
-      if (steep) {
-        write_pixel_lm(y, x, opaq, imode);
-      } else {
-        write_pixel_lm(x, y, opaq, imode);
+
+  const pixel_t value = pack_color(opaq, color);
+  int y0 = MAX(ymin, draw_target->clip.y0);
+  int y1 = MIN(ymax - 1, draw_target->clip.y1);
+
+  for (int y = ymin; y <= y1; y++) {
+    // Drop finished edges, add the ones starting at this row
+    int n = 0;
+    for (int i = 0; i < num_active; i++) {
+      if (active[i]->y1 > y) active[n++] = active[i];
+    }
+    num_active = n;
+    while (next_edge < num_edges && edges[next_edge].y0 == y) {
+      active[num_active++] = &edges[next_edge++];
+    }
+
+    for (int i = 0; i < num_active; i++) {
+      struct poly_edge *e = active[i];
+      e->num = (int64_t)e->x0 * e->dy + (int64_t)(y - e->y0) * e->dx;
+    }
+
+    if (y < y0) continue;
+
+    // Sort crossings by x, num / dy compared without division
+    for (int i = 1; i < num_active; i++) {
+      struct poly_edge *e = active[i];
+      int k = i;
+      while (k > 0 && active[k - 1]->num * e->dy > e->num * active[k - 1]->dy) {
+        active[k] = active[k - 1];
+        k--;
       }
+      active[k] = e;
     }
-    error -= deltay;
-    if (error < 0) {
-      y     += ystep;
-      error += deltax;
+
+    // Pixels between pairs of crossings, both ends inclusive
+    for (int i = 0; i + 1 < num_active; i += 2) {
+      int xa = -floor_div(-active[i]->num, active[i]->dy);
+      int xb = floor_div(active[i + 1]->num, active[i + 1]->dy);
+      if (xa <= xb) {
+        fill_rect(xa, y, xb, y, value);
+      }
     }
   }
 }
 
+/**
+ * write_polygon2d_filled: fill transformed vertices of a polygon object.
+ *
+ * @param       poly    polygon, vertices are relative to its x0, y0
+ * @param       color   0 = black, 1 = main, 2 = warn
+ * @param       opaq    0 = transparent, 1 = opaque
+ */
+void write_polygon2d_filled(POLYGON2D_PTR poly, int color, int opaq) {
+  int vx[POLYGON_MAX_VERTICES], vy[POLYGON_MAX_VERTICES];
+  int n = MIN(poly->num_verts, POLYGON_MAX_VERTICES);
+
+  for (int i = 0; i < n; i++) {
+    vx[i] = lroundf(poly->vlist_trans[i].x) + poly->x0;
+    vy[i] = lroundf(poly->vlist_trans[i].y) + poly->y0;
+  }
+  write_polygon_filled(vx, vy, n, color, opaq);
+}
+
+void write_triangle_filled(int x0, int y0, int x1, int y1, int x2, int y2) {
+  int vx[3] = { x0, x1, x2 };
+  int vy[3] = { y0, y1, y2 };
 
-void write_triangle_wire(int x0, int y0, int x1, int y1, int x2, int y2) {
-  write_line_lm(x0, y0, x1, y1, 1, 1);
-  write_line_lm(x0, y0, x2, y2, 1, 1);
-  write_line_lm(x2, y2, x1, y1, 1, 1);
+  write_polygon_filled(vx, vy, 3, 1, 1);
 }
 
 
@@ -697,6 +2177,168 @@ int fetch_font_info(uint8_t ch, int font, struct FontEntry *font_info, char *loo
   return 1;
 }
 
+// Pre-rasterized glyphs of a font in one color
+struct glyph_atlas
+{
+    int ready;
+    int width, height;
+    int offset[256];            // first row of the glyph, -1 if it is missing in the font
+    uint16_t *mask;             // coverage of each row, bit N is pixel N from the left
+    pixel_t *pixels;            // packed pixels, width per row
+};
+
+// Atlases are built on first use for each font, color and FONT_INVERT combination.
+// Render threads may ask for the same atlas at once, only one of them builds it.
+static struct glyph_atlas glyph_atlas[NUM_FONTS][3][2];
+static pthread_mutex_t glyph_atlas_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Fetch row of the font bitmap, bit (width - 1) is the leftmost pixel
+static int fetch_glyph_row(const struct FontEntry *font_info, int ch, int dy, uint16_t *levels, uint16_t *mask)
+{
+  switch (font_info->id) {
+  case 0:
+  case 1:
+  {
+    int lookup = (uint8_t)font_info->lookup[ch];
+    if (lookup == 0xff) {
+      return 0;
+    }
+    int row = lookup * font_info->height * 2 + dy;
+    *mask = (uint8_t)font_info->data[row];
+    *levels = (uint8_t)font_info->data[row + font_info->height];
+    return 1;
+  }
+  case 2:
+    *mask = font_mask8x10[ch * font_info->height + dy];
+    *levels = font_frame8x10[ch * font_info->height + dy];
+    return 1;
+  case 3:
+    *mask = font_mask12x18[ch * font_info->height + dy];
+    *levels = font_frame12x18[ch * font_info->height + dy];
+    return 1;
+  }
+  return 0;
+}
+
+static void build_glyph_atlas(struct glyph_atlas *ga, const struct FontEntry *font_info, int color, int invert)
+{
+  int w = font_info->width, h = font_info->height;
+  int rows = 0;
+
+  ga->width = w;
+  ga->height = h;
+  ga->mask = malloc(256 * h * sizeof(uint16_t));
+  ga->pixels = malloc(256 * h * w * sizeof(pixel_t));
+  assert(ga->mask != NULL && ga->pixels != NULL);
+
+  for (int ch = 0; ch < 256; ch++) {
+    uint16_t *mask = ga->mask + rows;
+    pixel_t *pixels = ga->pixels + rows * w;
+    uint16_t any = 0;
+    int dy;
+
+    for (dy = 0; dy < h; dy++) {
+      uint16_t levels, m;
+      if (!fetch_glyph_row(font_info, ch, dy, &levels, &m)) {
+        break;
+      }
+      if (invert) {
+        levels = ~levels;
+      }
+      mask[dy] = 0;
+      for (int dx = 0; dx < w; dx++) {
+        uint16_t bit = 1 << (w - 1 - dx);
+        pixels[dy * w + dx] = pack_color(1, (levels & bit) ? color : 0);
+        if (m & bit) {
+          mask[dy] |= 1 << dx;
+        }
+      }
+      any |= mask[dy];
+    }
+
+    if (dy < h || !any) {
+      ga->offset[ch] = -1;
+      continue;
+    }
+    ga->offset[ch] = rows;
+    rows += h;
+  }
+
+  // Keep only present glyphs
+  ga->mask = realloc(ga->mask, MAX(rows, 1) * sizeof(uint16_t));
+  ga->pixels = realloc(ga->pixels, MAX(rows, 1) * w * sizeof(pixel_t));
+  __atomic_store_n(&ga->ready, 1, __ATOMIC_RELEASE);
+}
+
+static const struct glyph_atlas* get_glyph_atlas(int font, int color, int invert)
+{
+  struct FontEntry font_info;
+
+  if (font < 0 || font >= NUM_FONTS || !fetch_font_info(0, font, &font_info, NULL)) {
+    return NULL;
+  }
+  assert(color >= 0 && color <= 2);
+
+  // Only outlined fonts support inversion
+  if (font_info.id >= 2) {
+    invert = 0;
+  }
+
+  struct glyph_atlas *ga = &glyph_atlas[font][color][invert ? 1 : 0];
+  if (!__atomic_load_n(&ga->ready, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&glyph_atlas_mutex);
+    if (!ga->ready) {
+      build_glyph_atlas(ga, &font_info, color, invert);
+    }
+    pthread_mutex_unlock(&glyph_atlas_mutex);
+  }
+  return ga;
+}
+
+// Copy covered pixels of a glyph to the draw buffer
+static void draw_glyph(const struct glyph_atlas *ga, uint8_t ch, int x, int y)
+{
+  if (ga == NULL || ga->offset[ch] < 0) {
+    return;
+  }
+
+  const struct clip_rect *clip = &draw_target->clip;
+  int w = ga->width;
+  int x0 = MAX(x, clip->x0);
+  int y0 = MAX(y, clip->y0);
+  int x1 = MIN(x + w - 1, clip->x1);
+  int y1 = MIN(y + ga->height - 1, clip->y1);
+
+  if (x0 > x1 || y0 > y1) {
+    return;
+  }
+
+  mark_drawn(x0, y0, x1, y1);
+
+  const uint16_t full = (1 << w) - 1;
+  const uint16_t *mask = ga->mask + ga->offset[ch];
+  const pixel_t *pixels = ga->pixels + ga->offset[ch] * w;
+  int dx0 = x0 - x, dx1 = x1 - x;
+
+  for (int yy = y0; yy <= y1; yy++) {
+    int dy = yy - y;
+    uint16_t m = mask[dy];
+    const pixel_t *src = pixels + dy * w;
+    pixel_t *dst = pixel_ptr(x0, yy);
+
+    if (m == full && dx0 == 0 && dx1 == w - 1) {
+      memcpy(dst, src, w * sizeof(pixel_t));
+      continue;
+    }
+
+    for (int dx = dx0; dx <= dx1; dx++) {
+      if (m & (1 << dx)) {
+        dst[dx - dx0] = src[dx];
+      }
+    }
+  }
+}
+
 /**
  * write_char16: Draw a character on the current draw buffer.
  *
@@ -706,35 +2348,14 @@ int fetch_font_info(uint8_t ch, int font, struct FontEntry *font_info, char *loo
  * @param       font    font to use
  */
 void write_char16(char ch, int x, int y, int font, int color) {
-  struct FontEntry font_info;
-  fetch_font_info(0, font, &font_info, NULL);
-
-  // If font only supports lowercase or uppercase, make the letter lowercase or uppercase
-  // if (font_info.flags & FONT_LOWERCASE_ONLY) ch = tolower(ch);
-  // if (font_info.flags & FONT_UPPERCASE_ONLY) ch = toupper(ch);
-
-  // How wide is the character? We handle characters from 8 pixels up in this function
-  if (font_info.width >= 8) {
-    // We can write mask words easily.
-    // Level bits are more complicated. We need to set or clear level bits, but only where the mask bit is set; otherwise, we need to leave them alone.
-    // To do this, for each word, we construct an AND mask and an OR mask, and apply each individually.
-    for (int dy = 0; dy < font_info.height; dy++) {
-        uint16_t levels, mask;
-        int row = ch * font_info.height + dy;
-        if (font == 3) {
-            levels = font_frame12x18[row];
-            mask = font_mask12x18[row];
-        }else{
-            levels = font_frame8x10[row];
-            mask = font_mask8x10[row];
-        }
-        for(int dx = 0; dx < font_info.width; dx++) {
-            uint16_t xshift = font_info.width - 1;
-            if (mask & (1 << (xshift - dx)))
-              write_pixel_lm(x + dx + 1, y + dy + 1, 1, (levels & (1 << (xshift - dx))) ? color : 0);
-        }
-    }
+  if (dl_recording) {
+    // Atlas is built before rendering threads use it
+    get_glyph_atlas(font, color, 0);
+    dl_append(dl_recording, DL_CHAR16, y, y + 19, NULL, 0, 5, ch, x, y, font, color);
+    return;
   }
+  // Glyphs of these fonts have one pixel offset
+  draw_glyph(get_glyph_atlas(font, color, 0), ch, x + 1, y + 1);
 }
 
 /**
@@ -748,33 +2369,12 @@ void write_char16(char ch, int x, int y, int font, int color) {
  * @param       font    font to use
  */
 void write_char(char ch, int x, int y, int flags, int font, int color) {
-  struct FontEntry font_info;
-  char lookup = 0;
-
-  fetch_font_info(ch, font, &font_info, &lookup);
-
-  // If font only supports lowercase or uppercase, make the letter lowercase or uppercase
-  // if (font_info.flags & FONT_LOWERCASE_ONLY) ch = tolower(ch);
-  // if (font_info.flags & FONT_UPPERCASE_ONLY) ch = toupper(ch);
-
-  // How wide is the character? We handle characters up to 8 pixels in this function
-  if (font_info.width <= 8) {
-    // Load data pointer.
-    for (int dy = 0; dy < font_info.height; dy++) {
-        uint16_t levels, mask;
-        int row = lookup * font_info.height * 2 + dy;
-        for(int dx = 0; dx < font_info.width; dx++) {
-            uint16_t xshift = font_info.width - 1;
-            levels = font_info.data[row + font_info.height];
-            if (flags & FONT_INVERT) {
-                levels = ~levels;
-            }
-            mask = font_info.data[row];
-            if (mask & (1 << (xshift - dx)))
-              write_pixel_lm(x + dx, y + dy, 1, (levels & (1 << (xshift - dx))) ? color : 0);
-        }
-    }
+  if (dl_recording) {
+    get_glyph_atlas(font, color, flags & FONT_INVERT);
+    dl_append(dl_recording, DL_CHAR, y, y + 18, NULL, 0, 6, ch, x, y, flags, font, color);
+    return;
   }
+  draw_glyph(get_glyph_atlas(font, color, flags & FONT_INVERT), ch, x, y);
 }
 
 /**
@@ -829,38 +2429,54 @@ void write_string(char *str, int x, int y, int xs, int ys, int va, int ha, int f
   write_color_string(str, x, y, xs, ys, va, ha, flags, font, 1);
 }
 
-void write_color_string(char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font, int color) {
-
-  int xx = 0, yy = 0, xx_original = 0;
-  struct FontEntry font_info;
-  struct FontDimensions dim;
+// Top left corner of a text block with given alignment
+static void calc_text_origin(struct FontDimensions *dim, int x, int y, int va, int ha, int *xx, int *yy)
+{
+  *xx = 0;
+  *yy = 0;
 
-  //font = 2;
-  // Determine font info and dimensions/position of the string.
-  fetch_font_info(0, font, &font_info, NULL);
-  calc_text_dimensions(str, font_info, xs, ys, &dim);
   switch (va) {
   case TEXT_VA_TOP:
-    yy = y;
+    *yy = y;
     break;
   case TEXT_VA_MIDDLE:
-    yy = y - (dim.height / 2);
+    *yy = y - (dim->height / 2);
     break;
   case TEXT_VA_BOTTOM:
-    yy = y - dim.height;
+    *yy = y - dim->height;
     break;
   }
   switch (ha) {
   case TEXT_HA_LEFT:
-    xx = x;
+    *xx = x;
     break;
   case TEXT_HA_CENTER:
-    xx = x - (dim.width / 2);
+    *xx = x - (dim->width / 2);
     break;
   case TEXT_HA_RIGHT:
-    xx = x - dim.width;
+    *xx = x - dim->width;
     break;
   }
+}
+
+void write_color_string(char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font, int color) {
+
+  int xx = 0, yy = 0, xx_original = 0;
+  struct FontEntry font_info;
+  struct FontDimensions dim;
+
+  //font = 2;
+  // Determine font info and dimensions/position of the string.
+  fetch_font_info(0, font, &font_info, NULL);
+  calc_text_dimensions(str, font_info, xs, ys, &dim);
+  calc_text_origin(&dim, x, y, va, ha, &xx, &yy);
+
+  if (dl_recording) {
+    get_glyph_atlas(font, color, flags & FONT_INVERT);
+    dl_append(dl_recording, DL_STRING, yy, yy + dim.height + 1, str, strlen(str) + 1, 9, x, y, xs, ys, va, ha, flags, font, color);
+    return;
+  }
+
   // Then write each character.
   xx_original = xx;
   while (*str != 0) {
@@ -868,7 +2484,7 @@ void write_color_string(char *str, int x, int y, int xs, int ys, int va, int ha,
       yy += ys + font_info.height;
       xx  = xx_original;
     } else {
-      if (xx >= GRAPHICS_LEFT && xx < GRAPHICS_RIGHT) {
+      if (xx >= draw_target->clip.x0 && xx < draw_target->clip.x1) {
         if (font_info.id < 2) {
           write_char(*str, xx, yy, flags, font, color);
         } else {
@@ -881,3 +2497,336 @@ void write_color_string(char *str, int x, int y, int xs, int ys, int va, int ha,
   }
 }
 
+// Text cache statistics
+unsigned long text_cache_hits = 0;
+unsigned long text_cache_misses = 0;
+
+static int text_cache_match(struct text_cache *tc, char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font, int color)
+{
+  return tc->valid &&
+         tc->x == x && tc->y == y && tc->xs == xs && tc->ys == ys &&
+         tc->va == va && tc->ha == ha && tc->flags == flags && tc->font == font && tc->color == color &&
+         memcmp(&tc->clip, &draw_target->clip, sizeof(tc->clip)) == 0 &&
+         strcmp(tc->str, str) == 0;
+}
+
+// Rasterize string into the cache tile
+static void text_cache_update(struct text_cache *tc, char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font, int color)
+{
+  struct FontEntry font_info;
+  struct FontDimensions dim;
+  struct render_target tile_rt;
+  int xx, yy;
+
+  strcpy(tc->str, str);
+  tc->x = x;
+  tc->y = y;
+  tc->xs = xs;
+  tc->ys = ys;
+  tc->va = va;
+  tc->ha = ha;
+  tc->flags = flags;
+  tc->font = font;
+  tc->color = color;
+  tc->clip = draw_target->clip;
+  tc->valid = 1;
+  tc->generation++;
+
+  // Bounding box of the glyphs (write_char16 draws with 1 pixel offset)
+  fetch_font_info(0, font, &font_info, NULL);
+  calc_text_dimensions(str, font_info, xs, ys, &dim);
+  calc_text_origin(&dim, x, y, va, ha, &xx, &yy);
+
+  tc->tile.x0 = MAX(xx, tc->clip.x0);
+  tc->tile.y0 = MAX(yy, tc->clip.y0);
+  tc->tile.x1 = MIN(xx + dim.width + 1, tc->clip.x1);
+  tc->tile.y1 = MIN(yy + dim.height + 1, tc->clip.y1);
+
+  if (tc->tile.x0 > tc->tile.x1 || tc->tile.y0 > tc->tile.y1)
+  {
+    tc->tile_w = 0;
+    tc->tile_h = 0;
+    return;
+  }
+
+  tc->tile_w = tc->tile.x1 - tc->tile.x0 + 1;
+  tc->tile_h = tc->tile.y1 - tc->tile.y0 + 1;
+
+  if (tc->tile_w * tc->tile_h > tc->capacity)
+  {
+    tc->capacity = tc->tile_w * tc->tile_h;
+    tc->pixels = realloc(tc->pixels, tc->capacity * sizeof(pixel_t));
+    assert(tc->pixels != NULL);
+  }
+  memset(tc->pixels, '\0', tc->tile_w * tc->tile_h * sizeof(pixel_t));
+
+  // Tile is drawn in screen coordinates, base points to the virtual (0, 0)
+  int stride = tc->tile_w * sizeof(pixel_t);
+  uint8_t *base = (uint8_t*)tc->pixels - tc->tile.y0 * stride - tc->tile.x0 * (int)sizeof(pixel_t);
+
+  render_target_init(&tile_rt, base, stride, tc->tile.x1 + 1, tc->tile.y1 + 1, draw_target->format);
+  tile_rt.clip = tc->tile;
+
+  struct render_target *prev = set_render_target(&tile_rt);
+  struct display_list *prev_recording = dl_recording;
+  dl_recording = NULL;
+  write_color_string(str, x, y, xs, ys, va, ha, flags, font, color);
+  dl_recording = prev_recording;
+  set_render_target(prev);
+}
+
+/**
+ * write_text_cache: Copy opaque pixels of the cache tile to the draw buffer.
+ *
+ * @param       tc      cache of the widget
+ */
+void write_text_cache(struct text_cache *tc)
+{
+  if (tc->tile_w == 0) return;
+
+  if (dl_recording) {
+    dl_append(dl_recording, DL_TEXT_TILE, tc->tile.y0, tc->tile.y1, &tc, sizeof(tc), 1, tc->generation);
+    return;
+  }
+
+  const struct clip_rect *clip = &draw_target->clip;
+  int x0 = MAX(tc->tile.x0, clip->x0);
+  int y0 = MAX(tc->tile.y0, clip->y0);
+  int x1 = MIN(tc->tile.x1, clip->x1);
+  int y1 = MIN(tc->tile.y1, clip->y1);
+
+  if (x0 > x1 || y0 > y1) return;
+
+  mark_drawn(x0, y0, x1, y1);
+
+  for (int y = y0; y <= y1; y++)
+  {
+    const pixel_t *src = tc->pixels + (y - tc->tile.y0) * tc->tile_w + (x0 - tc->tile.x0);
+    pixel_t *dst = pixel_ptr(x0, y);
+    for (int i = 0; i <= x1 - x0; i++)
+    {
+      if (src[i]) dst[i] = src[i];
+    }
+  }
+}
+
+/**
+ * write_color_string_cached: Draw a string using a raster cache.
+ * The string is rasterized only when it or any other parameter changes,
+ * otherwise the tile kept in the cache is copied to the draw buffer.
+ *
+ * @param       tc      cache of the widget
+ * Other parameters are the same as for write_color_string
+ */
+void write_color_string_cached(struct text_cache *tc, char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font, int color)
+{
+  if (strlen(str) >= sizeof(tc->str))
+  {
+    tc->valid = 0;
+    write_color_string(str, x, y, xs, ys, va, ha, flags, font, color);
+    return;
+  }
+
+  if (text_cache_match(tc, str, x, y, xs, ys, va, ha, flags, font, color))
+  {
+    text_cache_hits++;
+  } else {
+    text_cache_misses++;
+    text_cache_update(tc, str, x, y, xs, ys, va, ha, flags, font, color);
+  }
+
+  write_text_cache(tc);
+}
+
+void write_string_cached(struct text_cache *tc, char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font)
+{
+  write_color_string_cached(tc, str, x, y, xs, ys, va, ha, flags, font, 1);
+}
+
+/**
+ * write_text_cache_unchanged: Draw the cached tile again if the widget data
+ * didn't change since it was drawn, so the widget can skip formatting.
+ * Otherwise the widget draws with write_*_cached as usual.
+ *
+ * @param       tc      cache of the widget
+ * @param       source  version of everything the widget output depends on
+ * @return      1 if the tile was drawn
+ */
+int write_text_cache_unchanged(struct text_cache *tc, unsigned int source)
+{
+  int unchanged = tc->valid && tc->source == source &&
+                  memcmp(&tc->clip, &draw_target->clip, sizeof(tc->clip)) == 0;
+
+  tc->source = source;
+  if (!unchanged) return 0;
+
+  text_cache_hits++;
+  write_text_cache(tc);
+  return 1;
+}
+
+
+// Parallel rasterization: commands of a recorded frame are binned by
+// horizontal bands and replayed by a pool of threads, each band clipped
+// to its own rows. Bands are aligned to damage tiles, so threads never
+// share a pixel or a damage map word.
+
+// Off unless enabled with -t: on a single core the pool only adds overhead
+// and scaling on multi-core boards is still to be measured
+int render_threads = 1;
+
+struct render_band
+{
+    int y0, y1;
+    int count, capacity;
+    size_t *cmds;               // offsets of commands touching the band
+};
+
+static const struct display_list *pool_list = NULL;
+static struct render_band *bands = NULL;
+static int band_count = 0;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static int pool_generation = 0;
+static int pool_active = 0;
+static int pool_next_band = 0;
+static struct render_target pool_target;
+
+static void render_pool_bin(const struct display_list *dl)
+{
+    for (int i = 0; i < band_count; i++)
+    {
+        bands[i].count = 0;
+    }
+
+    for (const struct dl_cmd *cmd = DL_FIRST(dl); cmd < DL_END(dl); cmd = DL_NEXT(cmd))
+    {
+        for (int i = 0; i < band_count; i++)
+        {
+            struct render_band *band = &bands[i];
+
+            if (cmd->y1 < band->y0 || cmd->y0 > band->y1) continue;
+
+            if (band->count == band->capacity)
+            {
+                band->capacity = band->capacity ? band->capacity * 2 : 256;
+                band->cmds = realloc(band->cmds, band->capacity * sizeof(size_t));
+                assert(band->cmds != NULL);
+            }
+            band->cmds[band->count++] = (const uint8_t*)cmd - dl->data;
+        }
+    }
+}
+
+// Replay bands until all of them are taken
+static void render_pool_bands(void)
+{
+    struct render_target *prev = draw_target;
+    int b;
+
+    while ((b = __sync_fetch_and_add(&pool_next_band, 1)) < band_count)
+    {
+        struct render_band *band = &bands[b];
+        struct render_target rt = pool_target;
+
+        rt.clip.y0 = MAX(rt.clip.y0, band->y0);
+        rt.clip.y1 = MIN(rt.clip.y1, band->y1);
+        if (rt.clip.y0 > rt.clip.y1) continue;
+
+        draw_target = &rt;
+        for (int i = 0; i < band->count; i++)
+        {
+            dl_execute_cmd((const struct dl_cmd*)(pool_list->data + band->cmds[i]));
+        }
+    }
+
+    draw_target = prev;
+}
+
+static void* render_pool_worker(__attribute__((unused)) void *arg)
+{
+    int generation = 0;
+
+    pthread_mutex_lock(&pool_mutex);
+    while (1)
+    {
+        while (pool_generation == generation)
+        {
+            pthread_cond_wait(&pool_start, &pool_mutex);
+        }
+        generation = pool_generation;
+        pthread_mutex_unlock(&pool_mutex);
+
+        render_pool_bands();
+
+        pthread_mutex_lock(&pool_mutex);
+        if (--pool_active == 0)
+        {
+            pthread_cond_signal(&pool_done);
+        }
+    }
+    return NULL;
+}
+
+static void render_pool_init(void)
+{
+    // Few bands per thread to balance uneven layouts
+    int height = draw_target->height;
+    int band_height = (height + render_threads * 4 - 1) / (render_threads * 4);
+
+    band_height = (band_height + DAMAGE_TILE_HEIGHT - 1) / DAMAGE_TILE_HEIGHT * DAMAGE_TILE_HEIGHT;
+    band_count = (height + band_height - 1) / band_height;
+    bands = calloc(band_count, sizeof(struct render_band));
+    assert(bands != NULL);
+
+    for (int i = 0; i < band_count; i++)
+    {
+        bands[i].y0 = i * band_height;
+        bands[i].y1 = MIN((i + 1) * band_height, height) - 1;
+    }
+
+    // Calling thread is a worker too
+    for (int i = 1; i < render_threads; i++)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, render_pool_worker, NULL) != 0)
+        {
+            perror("Unable to create render thread");
+            exit(1);
+        }
+        pthread_detach(tid);
+    }
+
+    fprintf(stderr, "Using %d render threads, %d bands of %d lines\n", render_threads, band_count, band_height);
+}
+
+// Draw display list into the current target using all render threads
+static void render_pool_execute(const struct display_list *dl)
+{
+    if (bands == NULL)
+    {
+        render_pool_init();
+    }
+
+    render_pool_bin(dl);
+    pool_list = dl;
+    pool_target = *draw_target;
+    pool_next_band = 0;
+
+    pthread_mutex_lock(&pool_mutex);
+    pool_active = render_threads - 1;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_mutex);
+
+    render_pool_bands();
+
+    pthread_mutex_lock(&pool_mutex);
+    while (pool_active > 0)
+    {
+        pthread_cond_wait(&pool_done, &pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
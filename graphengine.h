@@ -1,8 +1,10 @@
 #ifndef GRAPH_ENGINE_H__
 #define GRAPH_ENGINE_H__
 
+#include <stdint.h>
 #include <pthread.h>
 #include "fonts.h"
+#include "m2dlib.h"
 
 extern int osd_debug;
 
@@ -105,6 +107,7 @@ typedef struct {
 extern int screen_width, screen_height;
 
 // PAL
+// Layout size of the OSD screen, widget coordinates are in this space
 #define GRAPHICS_WIDTH         640
 #define GRAPHICS_HEIGHT        360
 #define GRAPHICS_LEFT          0
@@ -115,15 +118,86 @@ extern int screen_width, screen_height;
 #define GRAPHICS_X_MIDDLE      (GRAPHICS_WIDTH  / 2)
 #define GRAPHICS_Y_MIDDLE      (GRAPHICS_HEIGHT / 2)
 
-// Check if coordinates are valid. If not, return. Assumes signed coordinates for working correct also with values lesser than 0.
-#define CHECK_COORDS(x, y)           if (x < GRAPHICS_LEFT || x > GRAPHICS_RIGHT || y < GRAPHICS_TOP || y > GRAPHICS_BOTTOM) { return; }
-#define CHECK_COORD_X(x)             if (x < GRAPHICS_LEFT || x > GRAPHICS_RIGHT) { return; }
-#define CHECK_COORD_Y(y)             if (y < GRAPHICS_TOP  || y > GRAPHICS_BOTTOM) { return; }
+// Size of the OSD render target, set with -s before render_init. Layout is
+// scaled to it by osd_layout_scale.
+extern int osd_width, osd_height;
+
+// Pixel formats of a render target
+typedef enum
+{
+    PIXEL_FORMAT_RGBA32 = 0,    // 32 bit, memory order R, G, B, A
+    PIXEL_FORMAT_I8,            // 8 bit palette index
+    PIXEL_FORMAT_ARGB1555,      // 16 bit word, 1 bit alpha, presentation only
+    PIXEL_FORMAT_ARGB4444,      // 16 bit word, 4 bit alpha, presentation only
+} pixel_format_t;
+
+// Drawing uses palette indices, backends expand them to RGBA when the frame
+// is presented. Build with -DOSD_RGBA_BUFFER to draw RGBA pixels directly.
+#ifdef OSD_RGBA_BUFFER
+typedef uint32_t pixel_t;
+#define OSD_PIXEL_FORMAT       PIXEL_FORMAT_RGBA32
+#else
+typedef uint8_t pixel_t;
+#define OSD_PIXEL_FORMAT       PIXEL_FORMAT_I8
+#endif
+
+// Palette: transparent, black, main and warn color, RGBA in memory order
+#define PALETTE_SIZE           4
+extern uint32_t osd_palette[PALETTE_SIZE];
+
+// Rectangle with inclusive coordinates
+struct clip_rect
+{
+    int x0, y0;
+    int x1, y1;
+};
+
+// Damage tracking granularity, a bit per tile
+#define DAMAGE_TILE_WIDTH      32
+#define DAMAGE_TILE_HEIGHT     8
+#define DAMAGE_MAX_COLS        64      // up to 2048 pixels wide
+#define DAMAGE_MAX_ROWS        256     // up to 2048 pixels high
+#define DAMAGE_MAX_RECTS       256     // rectangle list size used by backends
+
+// Set of tiles touched by drawing
+struct damage_map
+{
+    int width, height;                  // size of the covered area in pixels
+    int cols, rows;
+    uint64_t tiles[DAMAGE_MAX_ROWS];    // bit N is tile column N
+};
+
+// Nesting depth of push_clip_rect
+#define CLIP_STACK_DEPTH       8
+
+// Memory the graphics engine draws into
+struct render_target
+{
+    uint8_t *base;              // first byte of the top row
+    int stride;                 // bytes between two rows, negative for bottom-up buffers
+    int width, height;
+    pixel_format_t format;
+    struct clip_rect clip;      // drawing is limited to this rectangle
+    struct clip_rect clip_stack[CLIP_STACK_DEPTH];  // clip rectangles saved by push_clip_rect
+    int clip_depth;
+    struct damage_map *drawn;   // tiles drawn since last clear, NULL if not tracked
+};
+
+// Target used by all write_* primitives of the calling thread
+extern __thread struct render_target *draw_target;
+
+// Number of threads rasterizing a frame, 1 to draw directly
+extern int render_threads;
+
+// Check if coordinates are inside the clip rectangle. If not, return. Assumes signed coordinates for working correct also with values lesser than 0.
+#define CHECK_COORDS(x, y)           { CHECK_COORD_X(x); CHECK_COORD_Y(y); }
+#define CHECK_COORD_X(x)             if (x < draw_target->clip.x0 || x > draw_target->clip.x1) { return; }
+#define CHECK_COORD_Y(y)             if (y < draw_target->clip.y0 || y > draw_target->clip.y1) { return; }
 
 // Clip coordinates out of range. Assumes signed coordinates for working correct also with values lesser than 0.
 #define CLIP_COORDS(x, y)            { CLIP_COORD_X(x); CLIP_COORD_Y(y); }
-#define CLIP_COORD_X(x)              { x = x < GRAPHICS_LEFT ? GRAPHICS_LEFT : x > GRAPHICS_RIGHT ? GRAPHICS_RIGHT : x; }
-#define CLIP_COORD_Y(y)              { y = y < GRAPHICS_TOP ? GRAPHICS_TOP : y > GRAPHICS_BOTTOM ? GRAPHICS_BOTTOM : y; }
+#define CLIP_COORD_X(x)              { x = x < draw_target->clip.x0 ? draw_target->clip.x0 : x > draw_target->clip.x1 ? draw_target->clip.x1 : x; }
+#define CLIP_COORD_Y(y)              { y = y < draw_target->clip.y0 ? draw_target->clip.y0 : y > draw_target->clip.y1 ? draw_target->clip.y1 : y; }
 
 // Macro to swap two variables using XOR swap.
 #define SWAP(a, b)                   { a ^= b; b ^= a; a ^= b; }
@@ -131,10 +205,37 @@ extern int screen_width, screen_height;
 uint8_t getCharData(uint16_t charPos);
 
 void* render(void);
+void render_invalidate(void);
+struct display_list;
+void render_execute(const struct display_list *dl);
 void render_init(int shift_x, int shift_y, float scale_x, float scale_y);
+int render_event_fd(void);
+void render_handle_events(void);
+int render_ready(void);
+int render_refresh_rate(void);
 void clearGraphics(void);
 void* displayGraphics(void);
 
+void render_target_init(struct render_target *rt, void *base, int stride, int width, int height, pixel_format_t format);
+void render_target_set_clip(struct render_target *rt, int x0, int y0, int x1, int y1);
+struct render_target* set_render_target(struct render_target *rt);
+void push_clip_rect(int x0, int y0, int x1, int y1);
+void pop_clip_rect(void);
+void render_target_clear(struct render_target *rt, const struct damage_map *dm);
+void render_target_expand(const struct render_target *rt, const struct clip_rect *r, void *dst, int dst_stride);
+void render_target_pack(const struct render_target *rt, const struct clip_rect *r, void *dst, int dst_stride,
+                        pixel_format_t dst_format);
+int palette_fits_format(pixel_format_t format);
+int set_palette(const char *spec);
+
+void damage_map_init(struct damage_map *dm, int width, int height);
+void damage_map_clear(struct damage_map *dm);
+void damage_map_fill(struct damage_map *dm);
+void damage_map_add_rect(struct damage_map *dm, int x0, int y0, int x1, int y1);
+void damage_map_merge(struct damage_map *dst, const struct damage_map *src);
+int damage_map_empty(const struct damage_map *dm);
+int damage_map_to_rects(const struct damage_map *dm, struct clip_rect *rects, int max_rects);
+
 //void drawArrow(uint16_t x, uint16_t y, uint16_t angle, uint16_t size);
 void drawBox(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
 
@@ -156,6 +257,11 @@ void write_line_lm(int x0, int y0, int x1, int y1, int opaq, int color);
 void write_line_outlined(int x0, int y0, int x1, int y1, int endcap0, int endcap1, int mode, int opaq);
 void write_line_outlined_dashed(int x0, int y0, int x1, int y1, int endcap0, int endcap1, int mode, int opaq, int dots);
 
+// Largest polygon write_polygon_filled accepts
+#define POLYGON_MAX_VERTICES   OBJECT2DV1_MAX_VERTICES
+
+void write_polygon_filled(const int *vx, const int *vy, int num_verts, int color, int opaq);
+void write_polygon2d_filled(POLYGON2D_PTR poly, int color, int opaq);
 void write_triangle_filled(int x0, int y0, int x1, int y1, int x2, int y2);
 void write_triangle_wire(int x0, int y0, int x1, int y1, int x2, int y2);
 
@@ -165,11 +271,46 @@ void write_char(char ch, int x, int y, int flags, int font, int color);
 void write_string(char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font);
 void write_color_string(char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font, int color);
 
+// Raster cache of a string drawn by a widget
+struct text_cache
+{
+    // key
+    char str[64];
+    int x, y, xs, ys, va, ha, flags, font, color;
+    struct clip_rect clip;
+    int valid;
+    unsigned int generation;    // incremented when the tile is redrawn
+    unsigned int source;        // version of the widget data, see write_text_cache_unchanged
+
+    // pre-rasterized tile, transparent pixels are not copied
+    struct clip_rect tile;
+    int tile_w, tile_h;
+    pixel_t *pixels;
+    int capacity;
+};
+
+extern unsigned long text_cache_hits, text_cache_misses;
+
+void write_string_cached(struct text_cache *tc, char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font);
+void write_color_string_cached(struct text_cache *tc, char *str, int x, int y, int xs, int ys, int va, int ha, int flags, int font, int color);
+void write_text_cache(struct text_cache *tc);
+int write_text_cache_unchanged(struct text_cache *tc, unsigned int source);
+
 int fetch_font_info(uint8_t ch, int font, struct FontEntry *font_info, char *lookup);
 void calc_text_dimensions(char *str, struct FontEntry font, int xs, int ys, struct FontDimensions *dim);
 
 extern uint8_t* video_buf_ext;
-extern pthread_mutex_t video_mutex;
+
+// GStreamer OSD output: RGBA frames pushed by appsrc to glvideomixer, or an
+// overlay composition attached to decoded frames and blended by the sink
+typedef enum
+{
+    OSD_OUTPUT_MIXER = 0,
+    OSD_OUTPUT_COMPOSITION,
+} osd_output_t;
+
+extern osd_output_t osd_output;
+void render_set_output_size(int width, int height);
 
 #endif
 
@@ -20,6 +20,7 @@
  */
 #include "m2dlib.h"
 #include "osdvar.h"
+#include "graphengine.h"
 
 //Reset 2d object, just copy local verts to transfer verts
 void Reset_Polygon2D(POLYGON2D_PTR poly) {
@@ -129,8 +130,8 @@ int Scale_Polygon2D(POLYGON2D_PTR poly, float sx, float sy) {
 //return 1: visible
 //		 0: invisible
 int Clip_Line(VECTOR4D_PTR v) {
-  // this function clips the sent line using the globally defined clipping
-  // region
+  // this function clips the sent line using the clip rectangle of the
+  // current render target
 
   // internal clipping codes
 #define CLIP_CODE_C  0x0000
@@ -144,6 +145,9 @@ int Clip_Line(VECTOR4D_PTR v) {
 #define CLIP_CODE_NW 0x0009
 #define CLIP_CODE_SW 0x0005
 
+  const int min_clipX = draw_target->clip.x0, max_clipX = draw_target->clip.x1;
+  const int min_clipY = draw_target->clip.y0, max_clipY = draw_target->clip.y1;
+
   int x1 = v->x, y1 = v->y, x2 = v->z, y2 = v->w;
 
   int xc1 = x1, yc1 = y1, xc2 = x2, yc2 = y2;
@@ -151,24 +155,24 @@ int Clip_Line(VECTOR4D_PTR v) {
   int p1_code = 0, p2_code = 0;
 
   // determine codes for p1 and p2
-  if (y1 < atti_3d_min_clipY)
+  if (y1 < min_clipY)
     p1_code |= CLIP_CODE_N;
-  else if (y1 > atti_3d_max_clipY)
+  else if (y1 > max_clipY)
     p1_code |= CLIP_CODE_S;
 
-  if (x1 < atti_3d_min_clipX)
+  if (x1 < min_clipX)
     p1_code |= CLIP_CODE_W;
-  else if (x1 > atti_3d_max_clipX)
+  else if (x1 > max_clipX)
     p1_code |= CLIP_CODE_E;
 
-  if (y2 < atti_3d_min_clipY)
+  if (y2 < min_clipY)
     p2_code |= CLIP_CODE_N;
-  else if (y2 > atti_3d_max_clipY)
+  else if (y2 > max_clipY)
     p2_code |= CLIP_CODE_S;
 
-  if (x2 < atti_3d_min_clipX)
+  if (x2 < min_clipX)
     p2_code |= CLIP_CODE_W;
-  else if (x2 > atti_3d_max_clipX)
+  else if (x2 > max_clipX)
     p2_code |= CLIP_CODE_E;
 
   // try and trivially reject
@@ -185,39 +189,39 @@ int Clip_Line(VECTOR4D_PTR v) {
     break;
 
   case CLIP_CODE_N: {
-    yc1 = atti_3d_min_clipY;
-    xc1 = x1 + 0.5 + (atti_3d_min_clipY - y1) * (x2 - x1) / (y2 - y1);
+    yc1 = min_clipY;
+    xc1 = x1 + 0.5 + (min_clipY - y1) * (x2 - x1) / (y2 - y1);
   }
   break;
   case CLIP_CODE_S: {
-    yc1 = atti_3d_max_clipY;
-    xc1 = x1 + 0.5 + (atti_3d_max_clipY - y1) * (x2 - x1) / (y2 - y1);
+    yc1 = max_clipY;
+    xc1 = x1 + 0.5 + (max_clipY - y1) * (x2 - x1) / (y2 - y1);
   }
   break;
 
   case CLIP_CODE_W: {
-    xc1 = atti_3d_min_clipX;
-    yc1 = y1 + 0.5 + (atti_3d_min_clipX - x1) * (y2 - y1) / (x2 - x1);
+    xc1 = min_clipX;
+    yc1 = y1 + 0.5 + (min_clipX - x1) * (y2 - y1) / (x2 - x1);
   }
   break;
 
   case CLIP_CODE_E: {
-    xc1 = atti_3d_max_clipX;
-    yc1 = y1 + 0.5 + (atti_3d_max_clipX - x1) * (y2 - y1) / (x2 - x1);
+    xc1 = max_clipX;
+    yc1 = y1 + 0.5 + (max_clipX - x1) * (y2 - y1) / (x2 - x1);
   }
   break;
 
   // these cases are more complex, must compute 2 intersections
   case CLIP_CODE_NE: {
     // north hline intersection
-    yc1 = atti_3d_min_clipY;
-    xc1 = x1 + 0.5 + (atti_3d_min_clipY - y1) * (x2 - x1) / (y2 - y1);
+    yc1 = min_clipY;
+    xc1 = x1 + 0.5 + (min_clipY - y1) * (x2 - x1) / (y2 - y1);
 
     // test if intersection is valid, of so then done, else compute next
-    if (xc1 < atti_3d_min_clipX || xc1 > atti_3d_max_clipX) {
+    if (xc1 < min_clipX || xc1 > max_clipX) {
       // east vline intersection
-      xc1 = atti_3d_max_clipX;
-      yc1 = y1 + 0.5 + (atti_3d_max_clipX - x1) * (y2 - y1) / (x2 - x1);
+      xc1 = max_clipX;
+      yc1 = y1 + 0.5 + (max_clipX - x1) * (y2 - y1) / (x2 - x1);
     }     // end if
 
   }
@@ -225,14 +229,14 @@ int Clip_Line(VECTOR4D_PTR v) {
 
   case CLIP_CODE_SE: {
     // south hline intersection
-    yc1 = atti_3d_max_clipY;
-    xc1 = x1 + 0.5 + (atti_3d_max_clipY - y1) * (x2 - x1) / (y2 - y1);
+    yc1 = max_clipY;
+    xc1 = x1 + 0.5 + (max_clipY - y1) * (x2 - x1) / (y2 - y1);
 
     // test if intersection is valid, of so then done, else compute next
-    if (xc1 < atti_3d_min_clipX || xc1 > atti_3d_max_clipX) {
+    if (xc1 < min_clipX || xc1 > max_clipX) {
       // east vline intersection
-      xc1 = atti_3d_max_clipX;
-      yc1 = y1 + 0.5 + (atti_3d_max_clipX - x1) * (y2 - y1) / (x2 - x1);
+      xc1 = max_clipX;
+      yc1 = y1 + 0.5 + (max_clipX - x1) * (y2 - y1) / (x2 - x1);
     }     // end if
 
   }
@@ -240,13 +244,13 @@ int Clip_Line(VECTOR4D_PTR v) {
 
   case CLIP_CODE_NW: {
     // north hline intersection
-    yc1 = atti_3d_min_clipY;
-    xc1 = x1 + 0.5 + (atti_3d_min_clipY - y1) * (x2 - x1) / (y2 - y1);
+    yc1 = min_clipY;
+    xc1 = x1 + 0.5 + (min_clipY - y1) * (x2 - x1) / (y2 - y1);
 
     // test if intersection is valid, of so then done, else compute next
-    if (xc1 < atti_3d_min_clipX || xc1 > atti_3d_max_clipX) {
-      xc1 = atti_3d_min_clipX;
-      yc1 = y1 + 0.5 + (atti_3d_min_clipX - x1) * (y2 - y1) / (x2 - x1);
+    if (xc1 < min_clipX || xc1 > max_clipX) {
+      xc1 = min_clipX;
+      yc1 = y1 + 0.5 + (min_clipX - x1) * (y2 - y1) / (x2 - x1);
     }     // end if
 
   }
@@ -254,13 +258,13 @@ int Clip_Line(VECTOR4D_PTR v) {
 
   case CLIP_CODE_SW: {
     // south hline intersection
-    yc1 = atti_3d_max_clipY;
-    xc1 = x1 + 0.5 + (atti_3d_max_clipY - y1) * (x2 - x1) / (y2 - y1);
+    yc1 = max_clipY;
+    xc1 = x1 + 0.5 + (max_clipY - y1) * (x2 - x1) / (y2 - y1);
 
     // test if intersection is valid, of so then done, else compute next
-    if (xc1 < atti_3d_min_clipX || xc1 > atti_3d_max_clipX) {
-      xc1 = atti_3d_min_clipX;
-      yc1 = y1 + 0.5 + (atti_3d_min_clipX - x1) * (y2 - y1) / (x2 - x1);
+    if (xc1 < min_clipX || xc1 > max_clipX) {
+      xc1 = min_clipX;
+      yc1 = y1 + 0.5 + (min_clipX - x1) * (y2 - y1) / (x2 - x1);
     }     // end if
 
   }
@@ -277,40 +281,40 @@ int Clip_Line(VECTOR4D_PTR v) {
     break;
 
   case CLIP_CODE_N: {
-    yc2 = atti_3d_min_clipY;
-    xc2 = x2 + (atti_3d_min_clipY - y2) * (x1 - x2) / (y1 - y2);
+    yc2 = min_clipY;
+    xc2 = x2 + (min_clipY - y2) * (x1 - x2) / (y1 - y2);
   }
   break;
 
   case CLIP_CODE_S: {
-    yc2 = atti_3d_max_clipY;
-    xc2 = x2 + (atti_3d_max_clipY - y2) * (x1 - x2) / (y1 - y2);
+    yc2 = max_clipY;
+    xc2 = x2 + (max_clipY - y2) * (x1 - x2) / (y1 - y2);
   }
   break;
 
   case CLIP_CODE_W: {
-    xc2 = atti_3d_min_clipX;
-    yc2 = y2 + (atti_3d_min_clipX - x2) * (y1 - y2) / (x1 - x2);
+    xc2 = min_clipX;
+    yc2 = y2 + (min_clipX - x2) * (y1 - y2) / (x1 - x2);
   }
   break;
 
   case CLIP_CODE_E: {
-    xc2 = atti_3d_max_clipX;
-    yc2 = y2 + (atti_3d_max_clipX - x2) * (y1 - y2) / (x1 - x2);
+    xc2 = max_clipX;
+    yc2 = y2 + (max_clipX - x2) * (y1 - y2) / (x1 - x2);
   }
   break;
 
   // these cases are more complex, must compute 2 intersections
   case CLIP_CODE_NE: {
     // north hline intersection
-    yc2 = atti_3d_min_clipY;
-    xc2 = x2 + 0.5 + (atti_3d_min_clipY - y2) * (x1 - x2) / (y1 - y2);
+    yc2 = min_clipY;
+    xc2 = x2 + 0.5 + (min_clipY - y2) * (x1 - x2) / (y1 - y2);
 
     // test if intersection is valid, of so then done, else compute next
-    if (xc2 < atti_3d_min_clipX || xc2 > atti_3d_max_clipX) {
+    if (xc2 < min_clipX || xc2 > max_clipX) {
       // east vline intersection
-      xc2 = atti_3d_max_clipX;
-      yc2 = y2 + 0.5 + (atti_3d_max_clipX - x2) * (y1 - y2) / (x1 - x2);
+      xc2 = max_clipX;
+      yc2 = y2 + 0.5 + (max_clipX - x2) * (y1 - y2) / (x1 - x2);
     }     // end if
 
   }
@@ -318,14 +322,14 @@ int Clip_Line(VECTOR4D_PTR v) {
 
   case CLIP_CODE_SE: {
     // south hline intersection
-    yc2 = atti_3d_max_clipY;
-    xc2 = x2 + 0.5 + (atti_3d_max_clipY - y2) * (x1 - x2) / (y1 - y2);
+    yc2 = max_clipY;
+    xc2 = x2 + 0.5 + (max_clipY - y2) * (x1 - x2) / (y1 - y2);
 
     // test if intersection is valid, of so then done, else compute next
-    if (xc2 < atti_3d_min_clipX || xc2 > atti_3d_max_clipX) {
+    if (xc2 < min_clipX || xc2 > max_clipX) {
       // east vline intersection
-      xc2 = atti_3d_max_clipX;
-      yc2 = y2 + 0.5 + (atti_3d_max_clipX - x2) * (y1 - y2) / (x1 - x2);
+      xc2 = max_clipX;
+      yc2 = y2 + 0.5 + (max_clipX - x2) * (y1 - y2) / (x1 - x2);
     }     // end if
 
   }
@@ -333,13 +337,13 @@ int Clip_Line(VECTOR4D_PTR v) {
 
   case CLIP_CODE_NW: {
     // north hline intersection
-    yc2 = atti_3d_min_clipY;
-    xc2 = x2 + 0.5 + (atti_3d_min_clipY - y2) * (x1 - x2) / (y1 - y2);
+    yc2 = min_clipY;
+    xc2 = x2 + 0.5 + (min_clipY - y2) * (x1 - x2) / (y1 - y2);
 
     // test if intersection is valid, of so then done, else compute next
-    if (xc2 < atti_3d_min_clipX || xc2 > atti_3d_max_clipX) {
-      xc2 = atti_3d_min_clipX;
-      yc2 = y2 + 0.5 + (atti_3d_min_clipX - x2) * (y1 - y2) / (x1 - x2);
+    if (xc2 < min_clipX || xc2 > max_clipX) {
+      xc2 = min_clipX;
+      yc2 = y2 + 0.5 + (min_clipX - x2) * (y1 - y2) / (x1 - x2);
     }     // end if
 
   }
@@ -347,13 +351,13 @@ int Clip_Line(VECTOR4D_PTR v) {
 
   case CLIP_CODE_SW: {
     // south hline intersection
-    yc2 = atti_3d_max_clipY;
-    xc2 = x2 + 0.5 + (atti_3d_max_clipY - y2) * (x1 - x2) / (y1 - y2);
+    yc2 = max_clipY;
+    xc2 = x2 + 0.5 + (max_clipY - y2) * (x1 - x2) / (y1 - y2);
 
     // test if intersection is valid, of so then done, else compute next
-    if (xc2 < atti_3d_min_clipX || xc2 > atti_3d_max_clipX) {
-      xc2 = atti_3d_min_clipX;
-      yc2 = y2 + 0.5 + (atti_3d_min_clipX - x2) * (y1 - y2) / (x1 - x2);
+    if (xc2 < min_clipX || xc2 > max_clipX) {
+      xc2 = min_clipX;
+      yc2 = y2 + 0.5 + (min_clipX - x2) * (y1 - y2) / (x1 - x2);
     }     // end if
 
   }
@@ -365,10 +369,10 @@ int Clip_Line(VECTOR4D_PTR v) {
   }   // end switch
 
   // do bounds check
-  if ((xc1 < atti_3d_min_clipX) || (xc1 > atti_3d_max_clipX)
-      || (yc1 < atti_3d_min_clipY) || (yc1 > atti_3d_max_clipY)
-      || (xc2 < atti_3d_min_clipX) || (xc2 > atti_3d_max_clipX)
-      || (yc2 < atti_3d_min_clipY) || (yc2 > atti_3d_max_clipY)) {
+  if ((xc1 < min_clipX) || (xc1 > max_clipX)
+      || (yc1 < min_clipY) || (yc1 > max_clipY)
+      || (xc2 < min_clipX) || (xc2 > max_clipX)
+      || (yc2 < min_clipY) || (yc2 > max_clipY)) {
     return (0);
   }   // end if
 
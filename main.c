@@ -19,6 +19,7 @@
  * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
 
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <string.h>
@@ -29,11 +30,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <poll.h>
+#include <sys/timerfd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -44,15 +47,22 @@
 #include "osdconfig.h"
 #include "UAVObj.h"
 #include "graphengine.h"
+#include "displaylist.h"
 
 
 #ifdef __GST_OPENGL__
-int gst_main(int rtp_port, char *codec, int rtp_jitter, osd_render_t osd_render, int screen_width, char *rtsp_url);
+int gst_main(int rtp_port, char *codec, int rtp_jitter, osd_render_t osd_render, int screen_width, char *rtsp_url, int bench_mode);
+extern int osd_render_thread;
 #endif
 
 static volatile uint8_t finished = 0;
 int osd_debug = 0;
 
+// Frame rate limits, frames are rendered only when something changed.
+// Max rate 0 follows the display refresh rate.
+static int min_rate = 1;
+static int max_rate = 30;
+
 void sigterm_handler(int signum)
 {
     finished = 1;
@@ -83,6 +93,154 @@ int open_udp_socket_for_rx(int port)
     return fd;
 }
 
+// UDP ingest: datagrams are read in batches by recvmmsg into a preallocated
+// ring of buffers, each with its kernel receive timestamp. Buffers are
+// touched only as far as datagrams fill them.
+#define RX_BATCH                32
+#define RX_BUF_SIZE             65536   // max UDP payload, as the previous recv() buffer
+#define INGEST_STATS_PERIOD     1000    // messages, reported in debug mode
+
+static uint8_t rx_bufs[RX_BATCH][RX_BUF_SIZE];
+static uint8_t rx_ctrl[RX_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+static struct iovec rx_iov[RX_BATCH];
+static struct mmsghdr rx_msgs[RX_BATCH];
+static struct mavlink_rx_packet rx_packets[RX_BATCH];
+
+static struct
+{
+    unsigned long syscalls;
+    unsigned long datagrams;
+    unsigned long messages;
+    unsigned long truncated;
+    uint64_t latency_sum;       // ns from kernel receive to parsing
+    uint64_t latency_max;
+} rx_stats;
+
+static void rx_init(int fd)
+{
+    int optval = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &optval, sizeof(optval)) < 0)
+    {
+        perror("Unable to enable receive timestamps");
+    }
+
+    for (int i = 0; i < RX_BATCH; i++)
+    {
+        rx_iov[i].iov_base = rx_bufs[i];
+        rx_iov[i].iov_len = sizeof(rx_bufs[i]);
+        rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        rx_msgs[i].msg_hdr.msg_control = rx_ctrl[i];
+    }
+}
+
+// Latency is counted for the parsed packets, rx_packets[0 .. parsed - 1]
+static void update_ingest_stats(int datagrams, int parsed, int messages, uint64_t now_ns)
+{
+    rx_stats.datagrams += datagrams;
+    rx_stats.messages += messages;
+
+    for (int i = 0; i < parsed; i++)
+    {
+        uint64_t latency = now_ns - MIN(rx_packets[i].rx_ns, now_ns);
+        rx_stats.latency_sum += latency;
+        rx_stats.latency_max = MAX(rx_stats.latency_max, latency);
+    }
+
+    if (rx_stats.messages < INGEST_STATS_PERIOD) return;
+
+    fprintf(stderr, "Ingest: %lu messages, %lu datagrams, %lu syscalls, %.3f syscalls/message, %lu truncated, latency avg %llu us, max %llu us\n",
+            rx_stats.messages, rx_stats.datagrams, rx_stats.syscalls,
+            (double)rx_stats.syscalls / rx_stats.messages, rx_stats.truncated,
+            (unsigned long long)(rx_stats.latency_sum / MAX(rx_stats.datagrams - rx_stats.truncated, 1) / 1000),
+            (unsigned long long)(rx_stats.latency_max / 1000));
+
+    memset(&rx_stats, '\0', sizeof(rx_stats));
+}
+
+/**
+ * rx_receive: read a batch of datagrams and pass it to the parser.
+ *
+ * @param       fd      UDP socket
+ * @param       flags   recvmmsg flags
+ * @return      number of datagrams, -1 on error with errno set
+ */
+static int rx_receive(int fd, int flags)
+{
+    struct timespec real_ts;
+    uint64_t now_ns;
+    int n, parsed = 0;
+
+    for (int i = 0; i < RX_BATCH; i++)
+    {
+        rx_msgs[i].msg_hdr.msg_controllen = sizeof(rx_ctrl[i]);
+        rx_msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    n = recvmmsg(fd, rx_msgs, RX_BATCH, flags, NULL);
+    rx_stats.syscalls++;
+
+    if (n <= 0)
+    {
+        return n;
+    }
+
+    // Kernel timestamps are CLOCK_REALTIME, parser uses the monotonic clock
+    clock_gettime(CLOCK_REALTIME, &real_ts);
+    now_ns = GetSystimeNS();
+    uint64_t real_ns = real_ts.tv_sec * 1000000000ULL + real_ts.tv_nsec;
+
+    for (int i = 0; i < n; i++)
+    {
+        struct msghdr *hdr = &rx_msgs[i].msg_hdr;
+        uint64_t rx_ns = now_ns;
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+            {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                uint64_t age_ns = real_ns - MIN(ts.tv_sec * 1000000000ULL + ts.tv_nsec, real_ns);
+                rx_ns = now_ns - MIN(age_ns, now_ns);
+            }
+        }
+
+        // Tail of the datagram is lost, don't let partial frames reach the parser
+        if (hdr->msg_flags & MSG_TRUNC)
+        {
+            rx_stats.truncated++;
+            continue;
+        }
+
+        rx_packets[parsed].data = rx_bufs[i];
+        rx_packets[parsed].len = rx_msgs[i].msg_len;
+        rx_packets[parsed].rx_ns = rx_ns;
+        parsed++;
+    }
+
+    int messages = parse_mavlink_batch(rx_packets, parsed);
+
+    if (osd_debug)
+    {
+        update_ingest_stats(n, parsed, messages, GetSystimeNS());
+    }
+
+    return n;
+}
+
+#ifndef __GST_OPENGL__
+// Time of the next frame in ns: when the OSD changes, but not before frame_ts
+// allowed by max rate and not after idle_ts required by min rate
+static uint64_t next_frame_ts(uint64_t frame_ts, uint64_t idle_ts)
+{
+    uint64_t due_ms = osd_next_frame_ms();
+    uint64_t due_ts = MIN(due_ms < UINT64_MAX / 1000000 ? due_ms * 1000000 : UINT64_MAX, idle_ts);
+    return MAX(due_ts, frame_ts);
+}
+#endif
+
 int main(int argc, char **argv)
 {
     int opt;
@@ -93,14 +251,23 @@ int main(int argc, char **argv)
     osd_render_t osd_render = OSD_RENDER_GL;
     int screen_width = 1920;
     char *rtsp_url = NULL;
+#ifdef __GST_OPENGL__
+    int bench_mode = 0;
+#endif
+    FILE *replay_file = NULL;
 
-    uint64_t render_ts = 0;
-    uint64_t cur_ts = 0;
-    uint8_t buf[65536]; // Max UDP packet size
     int fd;
-    struct pollfd fds[1];
 
-    while ((opt = getopt(argc, argv, "hdp:P:R:45j:xaw:")) != -1) {
+#ifndef __GST_OPENGL__
+    // Frame timing of the main loop, gstreamer drives rendering by itself
+    uint64_t frame_ts = 0;
+    uint64_t idle_ts = 0;
+    uint64_t cur_ts = 0;
+    struct pollfd fds[3];
+    int nfds = 2;
+#endif
+
+    while ((opt = getopt(argc, argv, "hdp:P:R:45j:xacbTw:s:t:L:r:C:m:M:")) != -1) {
         switch (opt) {
         case 'p':
             osd_port = atoi(optarg);
@@ -134,28 +301,106 @@ int main(int argc, char **argv)
             osd_render = OSD_RENDER_AUTO;
             break;
 
+#ifdef __GST_OPENGL__
+        case 'c':
+            osd_output = OSD_OUTPUT_COMPOSITION;
+            break;
+
+        case 'b':
+            bench_mode = 1;
+            break;
+
+        case 'T':
+            osd_render_thread = 1;
+            break;
+#endif
+
         case 'w':
             screen_width = atoi(optarg);
             break;
 
+        case 's':
+            if (sscanf(optarg, "%dx%d", &osd_width, &osd_height) != 2 ||
+                osd_width < 1 || osd_width > DAMAGE_MAX_COLS * DAMAGE_TILE_WIDTH ||
+                osd_height < 1 || osd_height > DAMAGE_MAX_ROWS * DAMAGE_TILE_HEIGHT)
+            {
+                goto show_usage;
+            }
+            break;
+
         case 'd':
             osd_debug = 1;
             break;
 
+        case 't':
+            render_threads = atoi(optarg);
+            if (render_threads < 1)
+            {
+                goto show_usage;
+            }
+            break;
+
+        case 'C':
+            if (set_palette(optarg) != 0)
+            {
+                goto show_usage;
+            }
+            break;
+
+        case 'm':
+            min_rate = atoi(optarg);
+            if (min_rate < 1)
+            {
+                goto show_usage;
+            }
+            break;
+
+        case 'M':
+            max_rate = atoi(optarg);
+            if (max_rate < 0)
+            {
+                goto show_usage;
+            }
+            break;
+
+        case 'L':
+            dl_dump_file = fopen(optarg, "wb");
+            if (dl_dump_file == NULL)
+            {
+                perror("Unable to open display list file");
+                exit(1);
+            }
+            break;
+
+        case 'r':
+            replay_file = fopen(optarg, "rb");
+            if (replay_file == NULL)
+            {
+                perror("Unable to open display list file");
+                exit(1);
+            }
+            break;
+
         case 'h':
         default:
         show_usage:
 
 #ifdef __GST_OPENGL__
-            fprintf(stderr, "%s [-p mavlink_port] [-P rtp_port] [ -R rtsp_url ] [-4] [-5] [-j rtp_jitter] [-x] [-a] [-w screen_width] \n", argv[0]);
-            fprintf(stderr, "Default: mavlink_port=%d, rtp_port=%d, rtsp_url=%s, codec=%s, rtp_jitter=%d, screen_width=%d\n",
+            fprintf(stderr, "%s [-p mavlink_port] [-P rtp_port] [ -R rtsp_url ] [-4] [-5] [-j rtp_jitter] [-x] [-a] [-c] [-b] [-T] [-w screen_width] [-s osd_size] [-t render_threads] [-L display_list_file] [-r display_list_file] [-C black,main,warn]\n", argv[0]);
+            fprintf(stderr, "Use -c to attach OSD to video as overlay composition instead of glvideomixer, -b to benchmark OSD output with test video\n");
+            fprintf(stderr, "Use -T to render OSD ahead in a separate thread instead of the gstreamer streaming thread\n");
+            fprintf(stderr, "Default: mavlink_port=%d, rtp_port=%d, rtsp_url=%s, codec=%s, rtp_jitter=%d, screen_width=%d, render_threads=%d\n",
                     osd_port, rtp_port,
                     rtsp_url != NULL ? rtsp_url : "none",
-                    codec, rtp_jitter, screen_width);
+                    codec, rtp_jitter, screen_width, render_threads);
 #else
-            fprintf(stderr, "%s [-p mavlink_port]\n", argv[0]);
-            fprintf(stderr, "Default: mavlink_port=%d\n", osd_port);
+            fprintf(stderr, "%s [-p mavlink_port] [-s osd_size] [-t render_threads] [-L display_list_file] [-r display_list_file] [-C black,main,warn] [-m min_rate] [-M max_rate]\n", argv[0]);
+            fprintf(stderr, "Use -M 0 to render at the display refresh rate\n");
+            fprintf(stderr, "Default: mavlink_port=%d, render_threads=%d, min_rate=%d, max_rate=%d\n", osd_port, render_threads, min_rate, max_rate);
 #endif
+            fprintf(stderr, "Use -s WIDTHxHEIGHT to render OSD at the display resolution, widget layout is scaled from %dx%d\n", GRAPHICS_WIDTH, GRAPHICS_HEIGHT);
+            fprintf(stderr, "Use -L to save rendered display lists, -r to replay them offscreen and print raster time of every frame\n");
+            fprintf(stderr, "Palette colors are RRGGBB or RRGGBBAA hex values, default 000000,00ff41,ff0000\n");
             fprintf(stderr, "WFB-ng OSD version " WFB_OSD_VERSION "\n");
             fprintf(stderr, "WFB-ng home page: <http://wfb-ng.org>\n");
             exit(1);
@@ -166,18 +411,28 @@ int main(int argc, char **argv)
         goto show_usage;
     }
 
+    if (replay_file != NULL)
+    {
+        int ret = dl_replay(replay_file);
+        fclose(replay_file);
+        exit(ret == 0 ? 0 : 1);
+    }
+
 #ifdef __GST_OPENGL__
-    printf("Use: mavlink_port=%d, rtp_port=%d, rtsp_url=%s, codec=%s, rtp_jitter=%d, osd_render=%d, screen_width=%d\n",
+    printf("Use: mavlink_port=%d, rtp_port=%d, rtsp_url=%s, codec=%s, rtp_jitter=%d, osd_render=%d, osd_output=%s, screen_width=%d%s\n",
            osd_port, rtp_port,
            rtsp_url != NULL ? rtsp_url : "none",
-           codec, rtp_jitter, osd_render, screen_width);
+           codec, rtp_jitter, osd_render,
+           osd_output == OSD_OUTPUT_COMPOSITION ? "composition" : "mixer",
+           screen_width, bench_mode ? ", benchmark" : "");
 
     osd_init(0, 0, 1, 1);
     fd = open_udp_socket_for_rx(osd_port);
+    rx_init(fd);
 
     void* gst_thread_start(void *arg)
     {
-        gst_main(rtp_port, codec, rtp_jitter, osd_render, screen_width, rtsp_url);
+        gst_main(rtp_port, codec, rtp_jitter, osd_render, screen_width, rtsp_url, bench_mode);
         fprintf(stderr, "gst thread exited\n");
         exit(1);
     }
@@ -187,16 +442,13 @@ int main(int argc, char **argv)
 
     while(1)
     {
-        ssize_t rsize;
-        while((rsize = recv(fd, buf, sizeof(buf), 0)) >= 0)
-        {
-            // Avoid race with rendering in gstreamer
-            pthread_mutex_lock(&video_mutex);
-            parse_mavlink_packet(buf, rsize);
-            pthread_mutex_unlock(&video_mutex);
-        }
+        int n;
+
+        // Block for the first datagram, then take all that are queued.
+        // Rendering in gstreamer reads published vehicle state, no locking.
+        while((n = rx_receive(fd, MSG_WAITFORONE)) >= 0);
 
-        if (rsize < 0 && errno != EINTR)
+        if (n < 0 && errno != EINTR)
         {
             perror("Error receiving packet");
             exit(1);
@@ -204,10 +456,33 @@ int main(int argc, char **argv)
     }
 
 #else
-    printf("Use mavlink_port=%d\n", osd_port);
-
     osd_init(0, 0, 1, 1);
+
+    if (max_rate == 0)
+    {
+        max_rate = render_refresh_rate();
+        if (max_rate <= 0)
+        {
+            fprintf(stderr, "Display refresh rate is unknown, using 30Hz\n");
+            max_rate = 30;
+        }
+    }
+
+    printf("Use mavlink_port=%d, min_rate=%d, max_rate=%d\n", osd_port, min_rate, max_rate);
+
     fd = open_udp_socket_for_rx(osd_port);
+    rx_init(fd);
+
+    // Frames are started by absolute deadlines on the monotonic clock
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0)
+    {
+        perror("Unable to create frame timer");
+        exit(1);
+    }
+
+    uint64_t frame_period = 1000000000ULL / max_rate;
+    uint64_t idle_period = 1000000000ULL / min_rate;
 
     if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0)
     {
@@ -218,6 +493,16 @@ int main(int argc, char **argv)
     memset(fds, '\0', sizeof(fds));
     fds[0].fd = fd;
     fds[0].events = POLLIN;
+    fds[1].fd = timer_fd;
+    fds[1].events = POLLIN;
+
+    // Backend signals when a back buffer becomes free (page-flip completion)
+    if (render_event_fd() >= 0)
+    {
+        fds[2].fd = render_event_fd();
+        fds[2].events = POLLIN;
+        nfds = 3;
+    }
 
     signal(SIGTERM, sigterm_handler);
     signal(SIGINT, sigterm_handler);
@@ -225,9 +510,30 @@ int main(int argc, char **argv)
     fprintf(stderr, "Starting event loop\n");
     while(!finished)
     {
-        cur_ts = GetSystimeMS();
-        uint64_t sleep_ts = render_ts > cur_ts ? render_ts - cur_ts : 0;
-        int rc = poll(fds, 1, sleep_ts);
+        cur_ts = GetSystimeNS();
+        uint64_t render_ts = next_frame_ts(frame_ts, idle_ts);
+        int timeout = 0;
+
+        if (render_ts > cur_ts)
+        {
+            struct itimerspec deadline = {
+                .it_value = { .tv_sec = render_ts / 1000000000ULL, .tv_nsec = render_ts % 1000000000ULL },
+            };
+
+            if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &deadline, NULL) < 0)
+            {
+                perror("Unable to set frame timer");
+                exit(1);
+            }
+            timeout = -1;
+        }
+        else if (!render_ready())
+        {
+            // Frame is due but the display holds all buffers, wait for the flip
+            timeout = 100;
+        }
+
+        int rc = poll(fds, nfds, timeout);
 
         if (rc < 0){
             if (errno == EINTR || errno == EAGAIN) continue;
@@ -242,21 +548,49 @@ int main(int argc, char **argv)
         }
 
         if (fds[0].revents & POLLIN){
-            ssize_t rsize;
-            while((rsize = recv(fd, buf, sizeof(buf), 0)) >= 0)
-            {
-                parse_mavlink_packet(buf, rsize);
-            }
-            if (rsize < 0 && errno != EWOULDBLOCK){
+            int n;
+
+            // Short batch means the socket queue is drained
+            while((n = rx_receive(fd, 0)) == RX_BATCH);
+
+            if (n < 0 && errno != EWOULDBLOCK){
                 perror("Error receiving packet");
                 exit(1);
             }
         }
 
-        cur_ts = GetSystimeMS();
-        if (render_ts <= cur_ts)
+        if (fds[1].revents & POLLIN)
+        {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+            {
+                perror("Unable to read frame timer");
+                exit(1);
+            }
+        }
+
+        if (nfds > 2 && (fds[2].revents & (POLLERR | POLLNVAL)))
         {
-            render_ts = cur_ts + 1000 / 30; // 30Hz osd refresh rate
+            fprintf(stderr, "display event error!");
+            exit(1);
+        }
+
+        if (nfds > 2 && (fds[2].revents & POLLIN))
+        {
+            render_handle_events();
+        }
+
+        cur_ts = GetSystimeNS();
+        if (next_frame_ts(frame_ts, idle_ts) <= cur_ts && render_ready())
+        {
+            // Frames stay on the max rate grid, missed slots are skipped
+            if (frame_ts == 0)
+            {
+                frame_ts = cur_ts;
+            }
+            uint64_t slot_ts = frame_ts + (cur_ts - frame_ts) / frame_period * frame_period;
+            frame_ts = slot_ts + frame_period;
+            idle_ts = slot_ts + idle_period;
             render();
         }
     }
@@ -14,6 +14,8 @@
  * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
 
+#include <stddef.h>
+
 #include "osdconfig.h"
 #include "graphengine.h"
 
@@ -300,3 +302,62 @@ osd_params_t osd_params = {
     .OSDMessages_posX=180,
     .OSDMessages_posY=285,
 };
+
+// Offsets of widget positions in osd_params, in GRAPHICS_WIDTH x GRAPHICS_HEIGHT space
+#define POS(field) offsetof(osd_params_t, field)
+
+static const size_t layout_pos_x[] = {
+    POS(Arm_posX), POS(BattVolt_posX), POS(BattCurrent_posX),
+    POS(BattRemaining_posX), POS(FlightMode_posX), POS(GpsStatus_posX),
+    POS(GpsHDOP_posX), POS(GpsLat_posX), POS(GpsLon_posX), POS(Gps2Status_posX),
+    POS(Gps2HDOP_posX), POS(Gps2Lat_posX), POS(Gps2Lon_posX), POS(Time_posX),
+    POS(TALT_posX), POS(Alt_Scale_posX), POS(TSPD_posX), POS(Speed_scale_posX),
+    POS(Throt_posX), POS(CWH_home_dist_posX), POS(CWH_wp_dist_posX),
+    POS(CWH_Nmode_posX), POS(Alarm_posX), POS(ClimbRate_posX), POS(RSSI_posX),
+    POS(Wind_posX), POS(Atti_mp_posX), POS(Atti_3D_posX),
+    POS(BattConsumed_posX), POS(TotalTripDist_posX), POS(Relative_ALT_posX),
+    POS(Air_Speed_posX), POS(Efficiency_posX), POS(LinkQuality_posX),
+    POS(Vario_Graph_posX), POS(HomeDirection_posX), POS(HomeLatitude_posX),
+    POS(HomeLongitude_posX), POS(WFBState_posX), POS(OSDMessages_posX),
+};
+
+static const size_t layout_pos_y[] = {
+    POS(Arm_posY), POS(BattVolt_posY), POS(BattCurrent_posY),
+    POS(BattRemaining_posY), POS(FlightMode_posY), POS(GpsStatus_posY),
+    POS(GpsHDOP_posY), POS(GpsLat_posY), POS(GpsLon_posY), POS(Gps2Status_posY),
+    POS(Gps2HDOP_posY), POS(Gps2Lat_posY), POS(Gps2Lon_posY), POS(Time_posY),
+    POS(TALT_posY), POS(TSPD_posY), POS(Throt_posY), POS(CWH_home_dist_posY),
+    POS(CWH_wp_dist_posY), POS(CWH_Tmode_posY), POS(CWH_Nmode_posY),
+    POS(Alarm_posY), POS(ClimbRate_posY), POS(RSSI_posY), POS(Wind_posY),
+    POS(Atti_mp_posY), POS(Atti_3D_posY), POS(Speed_scale_posY),
+    POS(Alt_Scale_posY), POS(BattConsumed_posY), POS(TotalTripDist_posY),
+    POS(Relative_ALT_posY), POS(Air_Speed_posY), POS(Efficiency_posY),
+    POS(LinkQuality_posY), POS(Vario_Graph_posY), POS(HomeDirection_posY),
+    POS(HomeLatitude_posY), POS(HomeLongitude_posY), POS(WFBState_posY),
+    POS(OSDMessages_posY),
+};
+
+#undef POS
+
+static void scale_positions(const size_t *offsets, int n, int size, int layout_size)
+{
+    for (int i = 0; i < n; i++)
+    {
+        uint16_t *pos = (uint16_t *)((uint8_t *)&osd_params + offsets[i]);
+        *pos = (uint32_t)*pos * size / layout_size;
+    }
+}
+
+/**
+ * osd_layout_scale: move widgets from the GRAPHICS_WIDTH x GRAPHICS_HEIGHT
+ * layout to a render target of another size. Only positions are scaled,
+ * fonts and widget sizes stay in pixels, so a larger target shows the
+ * same layout sharper and a smaller one is not upscaled.
+ *
+ * @param       width, height   render target size
+ */
+void osd_layout_scale(int width, int height)
+{
+    scale_positions(layout_pos_x, sizeof(layout_pos_x) / sizeof(layout_pos_x[0]), width, GRAPHICS_WIDTH);
+    scale_positions(layout_pos_y, sizeof(layout_pos_y) / sizeof(layout_pos_y[0]), height, GRAPHICS_HEIGHT);
+}
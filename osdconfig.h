@@ -351,4 +351,6 @@ typedef struct
 
 extern osd_params_t osd_params;
 
+void osd_layout_scale(int width, int height);
+
 #endif  //__OSD_CONFIG_H
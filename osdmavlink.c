@@ -24,22 +24,32 @@
 #include "osdconfig.h"
 #include "osdrender.h"
 
+// Group update: keep the group as it was before decoding the message,
+// then update its version
+#define VS_BEGIN(group) __typeof__(vs->group) prev_##group; memcpy(&prev_##group, &vs->group, sizeof(prev_##group))
+#define VS_END(group) vehicle_state_touch(&vs->group.version, &prev_##group, &vs->group, sizeof(prev_##group), now_ms)
+
 float Rad2Deg(float x)
 {
   return x * (180.0F / M_PI);
 }
 
-void parse_mavlink_packet(uint8_t *buf, int buflen)
+// Decode messages of one datagram into vehicle_state, returns number of messages
+static int parse_packet(const uint8_t *buf, int buflen, uint64_t now_ms)
 {
     mavlink_status_t status;
     mavlink_message_t msg;
     uint8_t mavtype;
+    vehicle_state_t *vs = &vehicle_state;
+    int messages = 0;
 
     for(int i = 0; i < buflen; i++)
     {
         uint8_t c = buf[i];
         if (mavlink_parse_char(0, c, &msg, &status))
         {
+            messages++;
+
             //handle msg
             switch (msg.msgid)
             {
@@ -56,170 +66,203 @@ void parse_mavlink_packet(uint8_t *buf, int buflen)
                     break;
                 }
 
-                mav_system    = msg.sysid;
-                mav_component = msg.compid;
-                mav_type      = mavtype;
-                autopilot = mavlink_msg_heartbeat_get_autopilot(&msg);
-                base_mode = mavlink_msg_heartbeat_get_base_mode(&msg);
-                custom_mode = mavlink_msg_heartbeat_get_custom_mode(&msg);
+                VS_BEGIN(heartbeat);
 
-                last_motor_armed = motor_armed;
-                motor_armed = base_mode & MAV_MODE_FLAG_SAFETY_ARMED;
+                vs->heartbeat.system    = msg.sysid;
+                vs->heartbeat.component = msg.compid;
+                vs->heartbeat.type      = mavtype;
+                vs->heartbeat.autopilot = mavlink_msg_heartbeat_get_autopilot(&msg);
+                vs->heartbeat.base_mode = mavlink_msg_heartbeat_get_base_mode(&msg);
+                vs->heartbeat.custom_mode = mavlink_msg_heartbeat_get_custom_mode(&msg);
 
-                if (!last_motor_armed && motor_armed) {
-                    armed_start_time = GetSystimeMS();
+                bool last_motor_armed = vs->heartbeat.motor_armed;
+                vs->heartbeat.motor_armed = vs->heartbeat.base_mode & MAV_MODE_FLAG_SAFETY_ARMED;
+
+                if (!last_motor_armed && vs->heartbeat.motor_armed) {
+                    vs->heartbeat.armed_start_time = GetSystimeMS();
                 }
 
-                if (last_motor_armed && !motor_armed) {
-                    total_armed_time = GetSystimeMS() - armed_start_time + total_armed_time;
-                    armed_start_time = 0;
+                if (last_motor_armed && !vs->heartbeat.motor_armed) {
+                    vs->heartbeat.total_armed_time = GetSystimeMS() - vs->heartbeat.armed_start_time + vs->heartbeat.total_armed_time;
+                    vs->heartbeat.armed_start_time = 0;
                 }
+                VS_END(heartbeat);
             }
             break;
 
             case MAVLINK_MSG_ID_HOME_POSITION:
             {
-                osd_home_lat = mavlink_msg_home_position_get_latitude(&msg) / 1e7;
-                osd_home_lon = mavlink_msg_home_position_get_longitude(&msg) / 1e7;
-                osd_home_alt = mavlink_msg_home_position_get_altitude(&msg) / 1000;
-                osd_got_home = 1;
+                VS_BEGIN(home);
+                vs->home.lat = mavlink_msg_home_position_get_latitude(&msg) / 1e7;
+                vs->home.lon = mavlink_msg_home_position_get_longitude(&msg) / 1e7;
+                vs->home.alt = mavlink_msg_home_position_get_altitude(&msg) / 1000;
+                vs->home.got_home = 1;
+                VS_END(home);
                 break;
             }
 
             case MAVLINK_MSG_ID_EXTENDED_SYS_STATE:
             {
-                vtol_state = mavlink_msg_extended_sys_state_get_vtol_state(&msg);
+                VS_BEGIN(ext_sys_state);
+                vs->ext_sys_state.vtol_state = mavlink_msg_extended_sys_state_get_vtol_state(&msg);
+                VS_END(ext_sys_state);
                 break;
             }
 
             case MAVLINK_MSG_ID_SYS_STATUS:
             {
-                osd_vbat_A = (mavlink_msg_sys_status_get_voltage_battery(&msg) / 1000.0f);                 //Battery voltage, in millivolts (1 = 1 millivolt)
-                osd_curr_A = mavlink_msg_sys_status_get_current_battery(&msg);                 //Battery current, in 10*milliamperes (1 = 10 milliampere)
-                osd_battery_remaining_A = mavlink_msg_sys_status_get_battery_remaining(&msg);                 //Remaining battery energy: (0%: 0, 100%: 100)
+                VS_BEGIN(sys_status);
+                vs->sys_status.vbat = (mavlink_msg_sys_status_get_voltage_battery(&msg) / 1000.0f);                 //Battery voltage, in millivolts (1 = 1 millivolt)
+                vs->sys_status.current = mavlink_msg_sys_status_get_current_battery(&msg);                 //Battery current, in 10*milliamperes (1 = 10 milliampere)
+                vs->sys_status.battery_remaining = mavlink_msg_sys_status_get_battery_remaining(&msg);                 //Remaining battery energy: (0%: 0, 100%: 100)
                 //custom_mode = mav_component;//Debug
                 //osd_nav_mode = mav_system;//Debug
+                VS_END(sys_status);
             }
             break;
 
             case MAVLINK_MSG_ID_BATTERY_STATUS:
             {
-                osd_curr_consumed_mah = mavlink_msg_battery_status_get_current_consumed(&msg);
+                VS_BEGIN(battery_status);
+                vs->battery_status.current_consumed = mavlink_msg_battery_status_get_current_consumed(&msg);
+                VS_END(battery_status);
             }
             break;
 
             case MAVLINK_MSG_ID_GPS_RAW_INT:
             {
-                osd_lat = mavlink_msg_gps_raw_int_get_lat(&msg) / 10000000.0;
-                osd_lon = mavlink_msg_gps_raw_int_get_lon(&msg) / 10000000.0;
-                osd_fix_type = mavlink_msg_gps_raw_int_get_fix_type(&msg);
-                osd_hdop = mavlink_msg_gps_raw_int_get_eph(&msg);
-                osd_satellites_visible = mavlink_msg_gps_raw_int_get_satellites_visible(&msg);
+                VS_BEGIN(gps);
+                vs->gps.lat = mavlink_msg_gps_raw_int_get_lat(&msg) / 10000000.0;
+                vs->gps.lon = mavlink_msg_gps_raw_int_get_lon(&msg) / 10000000.0;
+                vs->gps.fix_type = mavlink_msg_gps_raw_int_get_fix_type(&msg);
+                vs->gps.hdop = mavlink_msg_gps_raw_int_get_eph(&msg);
+                vs->gps.satellites_visible = mavlink_msg_gps_raw_int_get_satellites_visible(&msg);
+                VS_END(gps);
             }
             break;
 
             case MAVLINK_MSG_ID_GPS2_RAW:
             {
-                osd_lat2 = mavlink_msg_gps2_raw_get_lat(&msg) / 10000000.0;
-                osd_lon2 = mavlink_msg_gps2_raw_get_lon(&msg) / 10000000.0;
-                osd_fix_type2 = mavlink_msg_gps2_raw_get_fix_type(&msg);
-                osd_hdop2 = mavlink_msg_gps2_raw_get_eph(&msg);
-                osd_satellites_visible2 = mavlink_msg_gps2_raw_get_satellites_visible(&msg);
+                VS_BEGIN(gps2);
+                vs->gps2.lat = mavlink_msg_gps2_raw_get_lat(&msg) / 10000000.0;
+                vs->gps2.lon = mavlink_msg_gps2_raw_get_lon(&msg) / 10000000.0;
+                vs->gps2.fix_type = mavlink_msg_gps2_raw_get_fix_type(&msg);
+                vs->gps2.hdop = mavlink_msg_gps2_raw_get_eph(&msg);
+                vs->gps2.satellites_visible = mavlink_msg_gps2_raw_get_satellites_visible(&msg);
+                VS_END(gps2);
             }
             break;
 
             case MAVLINK_MSG_ID_VFR_HUD:
             {
-                osd_airspeed = mavlink_msg_vfr_hud_get_airspeed(&msg);
-                osd_groundspeed = mavlink_msg_vfr_hud_get_groundspeed(&msg);
-                osd_heading = mavlink_msg_vfr_hud_get_heading(&msg);                 // 0..360 deg, 0=north
-                osd_throttle = mavlink_msg_vfr_hud_get_throttle(&msg);
-                osd_alt = mavlink_msg_vfr_hud_get_alt(&msg);
-                osd_climb = mavlink_msg_vfr_hud_get_climb(&msg);
+                VS_BEGIN(vfr_hud);
+                vs->vfr_hud.airspeed = mavlink_msg_vfr_hud_get_airspeed(&msg);
+                vs->vfr_hud.groundspeed = mavlink_msg_vfr_hud_get_groundspeed(&msg);
+                vs->vfr_hud.heading = mavlink_msg_vfr_hud_get_heading(&msg);                 // 0..360 deg, 0=north
+                vs->vfr_hud.throttle = mavlink_msg_vfr_hud_get_throttle(&msg);
+                vs->vfr_hud.alt = mavlink_msg_vfr_hud_get_alt(&msg);
+                vs->vfr_hud.climb = mavlink_msg_vfr_hud_get_climb(&msg);
+                VS_END(vfr_hud);
             }
             break;
 
             // Workaround for ardupilot
             case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
             {
+                VS_BEGIN(vfr_hud);
+                VS_BEGIN(altitude);
                 mavlink_global_position_int_t global_position;
                 mavlink_msg_global_position_int_decode(&msg, &global_position);
-                osd_alt = global_position.alt / 1000.0;
-                osd_rel_alt = global_position.relative_alt / 1000.0;
+                vs->vfr_hud.alt = global_position.alt / 1000.0;
+                vs->altitude.rel_alt = global_position.relative_alt / 1000.0;
+                VS_END(vfr_hud);
+                VS_END(altitude);
             }
             break;
 
             case MAVLINK_MSG_ID_ALTITUDE:
             {
-                osd_bottom_clearance = mavlink_msg_altitude_get_bottom_clearance(&msg);
-                osd_rel_alt = mavlink_msg_altitude_get_altitude_relative(&msg);
+                VS_BEGIN(altitude);
+                vs->altitude.bottom_clearance = mavlink_msg_altitude_get_bottom_clearance(&msg);
+                vs->altitude.rel_alt = mavlink_msg_altitude_get_altitude_relative(&msg);
+                VS_END(altitude);
             }
             break;
 
             case MAVLINK_MSG_ID_ATTITUDE:
             {
-                osd_pitch = Rad2Deg(mavlink_msg_attitude_get_pitch(&msg));
-                osd_roll = Rad2Deg(mavlink_msg_attitude_get_roll(&msg));
-                osd_yaw = Rad2Deg(mavlink_msg_attitude_get_yaw(&msg));
+                VS_BEGIN(attitude);
+                vs->attitude.pitch = Rad2Deg(mavlink_msg_attitude_get_pitch(&msg));
+                vs->attitude.roll = Rad2Deg(mavlink_msg_attitude_get_roll(&msg));
+                vs->attitude.yaw = Rad2Deg(mavlink_msg_attitude_get_yaw(&msg));
+                VS_END(attitude);
             }
             break;
 
             case MAVLINK_MSG_ID_NAV_CONTROLLER_OUTPUT:
             {
-                nav_roll = mavlink_msg_nav_controller_output_get_nav_roll(&msg);
-                nav_pitch = mavlink_msg_nav_controller_output_get_nav_pitch(&msg);
-                nav_bearing = mavlink_msg_nav_controller_output_get_nav_bearing(&msg);
-                wp_target_bearing = mavlink_msg_nav_controller_output_get_target_bearing(&msg);
-                wp_dist = mavlink_msg_nav_controller_output_get_wp_dist(&msg);
-                alt_error = mavlink_msg_nav_controller_output_get_alt_error(&msg);
-                aspd_error = mavlink_msg_nav_controller_output_get_aspd_error(&msg);
-                xtrack_error = mavlink_msg_nav_controller_output_get_xtrack_error(&msg);
+                VS_BEGIN(nav_controller);
+                vs->nav_controller.nav_roll = mavlink_msg_nav_controller_output_get_nav_roll(&msg);
+                vs->nav_controller.nav_pitch = mavlink_msg_nav_controller_output_get_nav_pitch(&msg);
+                vs->nav_controller.nav_bearing = mavlink_msg_nav_controller_output_get_nav_bearing(&msg);
+                vs->nav_controller.target_bearing = mavlink_msg_nav_controller_output_get_target_bearing(&msg);
+                vs->nav_controller.wp_dist = mavlink_msg_nav_controller_output_get_wp_dist(&msg);
+                vs->nav_controller.alt_error = mavlink_msg_nav_controller_output_get_alt_error(&msg);
+                vs->nav_controller.aspd_error = mavlink_msg_nav_controller_output_get_aspd_error(&msg);
+                vs->nav_controller.xtrack_error = mavlink_msg_nav_controller_output_get_xtrack_error(&msg);
+                VS_END(nav_controller);
             }
             break;
 
             case MAVLINK_MSG_ID_MISSION_CURRENT:
             {
-                wp_number = (uint8_t)mavlink_msg_mission_current_get_seq(&msg);
+                VS_BEGIN(mission_current);
+                vs->mission_current.wp_number = (uint8_t)mavlink_msg_mission_current_get_seq(&msg);
+                VS_END(mission_current);
             }
             break;
 
             case MAVLINK_MSG_ID_RC_CHANNELS_RAW:
             {
-                if (!osd_chan_cnt_above_eight)
+                VS_BEGIN(rc_channels);
+                if (!vs->rc_channels.chan_cnt_above_eight)
                 {
-                    osd_chan1_raw = mavlink_msg_rc_channels_raw_get_chan1_raw(&msg);
-                    osd_chan2_raw = mavlink_msg_rc_channels_raw_get_chan2_raw(&msg);
-                    osd_chan3_raw = mavlink_msg_rc_channels_raw_get_chan3_raw(&msg);
-                    osd_chan4_raw = mavlink_msg_rc_channels_raw_get_chan4_raw(&msg);
-                    osd_chan5_raw = mavlink_msg_rc_channels_raw_get_chan5_raw(&msg);
-                    osd_chan6_raw = mavlink_msg_rc_channels_raw_get_chan6_raw(&msg);
-                    osd_chan7_raw = mavlink_msg_rc_channels_raw_get_chan7_raw(&msg);
-                    osd_chan8_raw = mavlink_msg_rc_channels_raw_get_chan8_raw(&msg);
-                    osd_rssi = mavlink_msg_rc_channels_raw_get_rssi(&msg);
+                    vs->rc_channels.chan_raw[0] = mavlink_msg_rc_channels_raw_get_chan1_raw(&msg);
+                    vs->rc_channels.chan_raw[1] = mavlink_msg_rc_channels_raw_get_chan2_raw(&msg);
+                    vs->rc_channels.chan_raw[2] = mavlink_msg_rc_channels_raw_get_chan3_raw(&msg);
+                    vs->rc_channels.chan_raw[3] = mavlink_msg_rc_channels_raw_get_chan4_raw(&msg);
+                    vs->rc_channels.chan_raw[4] = mavlink_msg_rc_channels_raw_get_chan5_raw(&msg);
+                    vs->rc_channels.chan_raw[5] = mavlink_msg_rc_channels_raw_get_chan6_raw(&msg);
+                    vs->rc_channels.chan_raw[6] = mavlink_msg_rc_channels_raw_get_chan7_raw(&msg);
+                    vs->rc_channels.chan_raw[7] = mavlink_msg_rc_channels_raw_get_chan8_raw(&msg);
+                    vs->rc_channels.rssi = mavlink_msg_rc_channels_raw_get_rssi(&msg);
                 }
+                VS_END(rc_channels);
             }
             break;
 
             case MAVLINK_MSG_ID_RC_CHANNELS:
             {
-                osd_chan_cnt_above_eight = true;
-                osd_chan1_raw = mavlink_msg_rc_channels_get_chan1_raw(&msg);
-                osd_chan2_raw = mavlink_msg_rc_channels_get_chan2_raw(&msg);
-                osd_chan3_raw = mavlink_msg_rc_channels_get_chan3_raw(&msg);
-                osd_chan4_raw = mavlink_msg_rc_channels_get_chan4_raw(&msg);
-                osd_chan5_raw = mavlink_msg_rc_channels_get_chan5_raw(&msg);
-                osd_chan6_raw = mavlink_msg_rc_channels_get_chan6_raw(&msg);
-                osd_chan7_raw = mavlink_msg_rc_channels_get_chan7_raw(&msg);
-                osd_chan8_raw = mavlink_msg_rc_channels_get_chan8_raw(&msg);
-                osd_chan9_raw = mavlink_msg_rc_channels_get_chan9_raw(&msg);
-                osd_chan10_raw = mavlink_msg_rc_channels_get_chan10_raw(&msg);
-                osd_chan11_raw = mavlink_msg_rc_channels_get_chan11_raw(&msg);
-                osd_chan12_raw = mavlink_msg_rc_channels_get_chan12_raw(&msg);
-                osd_chan13_raw = mavlink_msg_rc_channels_get_chan13_raw(&msg);
-                osd_chan14_raw = mavlink_msg_rc_channels_get_chan14_raw(&msg);
-                osd_chan15_raw = mavlink_msg_rc_channels_get_chan15_raw(&msg);
-                osd_chan16_raw = mavlink_msg_rc_channels_get_chan16_raw(&msg);
-                osd_rssi = mavlink_msg_rc_channels_get_rssi(&msg);
+                VS_BEGIN(rc_channels);
+                vs->rc_channels.chan_cnt_above_eight = true;
+                vs->rc_channels.chan_raw[0] = mavlink_msg_rc_channels_get_chan1_raw(&msg);
+                vs->rc_channels.chan_raw[1] = mavlink_msg_rc_channels_get_chan2_raw(&msg);
+                vs->rc_channels.chan_raw[2] = mavlink_msg_rc_channels_get_chan3_raw(&msg);
+                vs->rc_channels.chan_raw[3] = mavlink_msg_rc_channels_get_chan4_raw(&msg);
+                vs->rc_channels.chan_raw[4] = mavlink_msg_rc_channels_get_chan5_raw(&msg);
+                vs->rc_channels.chan_raw[5] = mavlink_msg_rc_channels_get_chan6_raw(&msg);
+                vs->rc_channels.chan_raw[6] = mavlink_msg_rc_channels_get_chan7_raw(&msg);
+                vs->rc_channels.chan_raw[7] = mavlink_msg_rc_channels_get_chan8_raw(&msg);
+                vs->rc_channels.chan_raw[8] = mavlink_msg_rc_channels_get_chan9_raw(&msg);
+                vs->rc_channels.chan_raw[9] = mavlink_msg_rc_channels_get_chan10_raw(&msg);
+                vs->rc_channels.chan_raw[10] = mavlink_msg_rc_channels_get_chan11_raw(&msg);
+                vs->rc_channels.chan_raw[11] = mavlink_msg_rc_channels_get_chan12_raw(&msg);
+                vs->rc_channels.chan_raw[12] = mavlink_msg_rc_channels_get_chan13_raw(&msg);
+                vs->rc_channels.chan_raw[13] = mavlink_msg_rc_channels_get_chan14_raw(&msg);
+                vs->rc_channels.chan_raw[14] = mavlink_msg_rc_channels_get_chan15_raw(&msg);
+                vs->rc_channels.chan_raw[15] = mavlink_msg_rc_channels_get_chan16_raw(&msg);
+                vs->rc_channels.rssi = mavlink_msg_rc_channels_get_rssi(&msg);
+                VS_END(rc_channels);
             }
             break;
 
@@ -229,21 +272,26 @@ void parse_mavlink_packet(uint8_t *buf, int buflen)
                     break;
                 }
 
-                wfb_rssi = (int8_t)mavlink_msg_radio_status_get_rssi(&msg);
-                wfb_errors = mavlink_msg_radio_status_get_rxerrors(&msg);
-                wfb_fec_fixed = mavlink_msg_radio_status_get_fixed(&msg);
-                wfb_flags = mavlink_msg_radio_status_get_remnoise(&msg);
+                VS_BEGIN(radio_status);
+
+                vs->radio_status.rssi = (int8_t)mavlink_msg_radio_status_get_rssi(&msg);
+                vs->radio_status.errors = mavlink_msg_radio_status_get_rxerrors(&msg);
+                vs->radio_status.fec_fixed = mavlink_msg_radio_status_get_fixed(&msg);
+                vs->radio_status.flags = mavlink_msg_radio_status_get_remnoise(&msg);
+                VS_END(radio_status);
             }
             break;
 
             case MAVLINK_MSG_ID_STATUSTEXT:
             {
-                osd_message_queue_tail = (osd_message_queue_tail + 1) % OSD_MAX_MESSAGES;
-                osd_message_t *item = osd_message_queue + osd_message_queue_tail;
+                VS_BEGIN(statustext);
+                vs->statustext.tail = (vs->statustext.tail + 1) % OSD_MAX_MESSAGES;
+                osd_message_t *item = vs->statustext.queue + vs->statustext.tail;
                 item->severity = mavlink_msg_statustext_get_severity(&msg);
                 mavlink_msg_statustext_get_text(&msg, item->message);
                 item->message[sizeof(item->message) - 1] = '\0';
                 printf("Message: %s\n", item->message);
+                VS_END(statustext);
             }
             break;
 
@@ -254,5 +302,43 @@ void parse_mavlink_packet(uint8_t *buf, int buflen)
             }   //end switch(msg.msgid)
         }
     }
+
+    return messages;
+}
+
+/**
+ * parse_mavlink_batch: decode datagrams received together and publish
+ * the resulting vehicle state once.
+ *
+ * @param       packets         received datagrams
+ * @param       count           number of datagrams
+ * @return      number of decoded MAVLink messages
+ */
+int parse_mavlink_batch(const struct mavlink_rx_packet *packets, int count)
+{
+    int messages = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        // Groups are stamped with the kernel receive time of their datagram
+        messages += parse_packet(packets[i].data, packets[i].len, packets[i].rx_ns / 1000000);
+    }
+
+    // Renderer sees all messages of the batch at once, a frame is requested
+    // after publishing so it can't snapshot the state before the batch
+    if (messages > 0)
+    {
+        vehicle_state_publish();
+        osd_mark_dirty();
+    }
+
+    return messages;
+}
+
+void parse_mavlink_packet(uint8_t *buf, int buflen)
+{
+    struct mavlink_rx_packet packet = { .data = buf, .len = buflen, .rx_ns = GetSystimeNS() };
+
+    parse_mavlink_batch(&packet, 1);
 }
 
@@ -3,6 +3,15 @@
 
 #include "mavlink/common/mavlink.h"
 
+// Received datagram
+struct mavlink_rx_packet
+{
+    const uint8_t *data;
+    int len;
+    uint64_t rx_ns;             // GetSystimeNS() time the datagram was received
+};
+
 void parse_mavlink_packet(uint8_t *buf, int buflen);
+int parse_mavlink_batch(const struct mavlink_rx_packet *packets, int count);
 
 #endif  //__OSD_MAVLINK_H
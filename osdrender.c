@@ -21,7 +21,6 @@
  */
 
 #include <assert.h>
-#include <sys/time.h>
 #include <time.h>
 #include "osdrender.h"
 #include "graphengine.h"
@@ -67,24 +66,71 @@ const char * dist_unit_long = METRIC_DIST_LONG;
 const char * spd_unit = METRIC_SPEED;
 
 
+/**
+ * GetSystimeNS: monotonic time for all internal timing.
+ * Unlike wall-clock time it doesn't jump on NTP or GPS time sync.
+ *
+ * @return      nanoseconds since an unspecified start point
+ */
+uint64_t GetSystimeNS(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 uint64_t GetSystimeMS(void) {
-    struct timeval te;
-    gettimeofday(&te, NULL); // get current time
-    uint64_t milliseconds = te.tv_sec * 1000LL + te.tv_usec / 1000; // caculate milliseconds
-    return milliseconds;
+    return GetSystimeNS() / 1000000;
+}
+
+// Render scheduling: a frame is needed when telemetry arrived or a timed
+// widget changes. Widgets report their next change while they are recorded.
+// Both are shared by the MAVLink and render threads, accessed atomically.
+static int osd_dirty = 1;
+static uint64_t osd_next_due = 0;
+
+/**
+ * osd_mark_dirty: request a frame as soon as the rate limit allows.
+ * Telemetry must be published before, a frame that clears the flag
+ * takes the snapshot after it.
+ */
+void osd_mark_dirty(void)
+{
+    __atomic_store_n(&osd_dirty, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * osd_schedule: request a frame at a given time. Called by widgets that
+ * change with time, while they are drawn.
+ *
+ * @param       due_ms  GetSystimeMS() time when the widget changes
+ */
+void osd_schedule(uint64_t due_ms)
+{
+    uint64_t next_due = __atomic_load_n(&osd_next_due, __ATOMIC_RELAXED);
+
+    while (due_ms < next_due &&
+           !__atomic_compare_exchange_n(&osd_next_due, &next_due, due_ms, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * osd_next_frame_ms: get the time the next frame is needed.
+ *
+ * @return      GetSystimeMS() time, 0 if a frame is needed now,
+ *              UINT64_MAX if nothing is going to change
+ */
+uint64_t osd_next_frame_ms(void)
+{
+    return __atomic_load_n(&osd_dirty, __ATOMIC_SEQ_CST) ? 0 : __atomic_load_n(&osd_next_due, __ATOMIC_RELAXED);
 }
 
 
 void osd_init(int shift_x, int shift_y, float scale_x, float scale_y)
 {
     sys_start_time = GetSystimeMS();
+    osd_layout_scale(osd_width, osd_height);
     render_init(shift_x, shift_y, scale_x, scale_y);
     atti_mp_scale = (float)osd_params.Atti_mp_scale_real + (float)osd_params.Atti_mp_scale_frac * 0.01;
     atti_3d_scale = (float)osd_params.Atti_3D_scale_real + (float)osd_params.Atti_3D_scale_frac * 0.01;
-    atti_3d_min_clipX = osd_params.Atti_mp_posX - (uint32_t)(22 * atti_mp_scale);
-    atti_3d_max_clipX = osd_params.Atti_mp_posX + (uint32_t)(22 * atti_mp_scale);
-    atti_3d_min_clipY = osd_params.Atti_mp_posY - (uint32_t)(30 * atti_mp_scale);
-    atti_3d_max_clipY = osd_params.Atti_mp_posY + (uint32_t)(34 * atti_mp_scale);
 
     Build_Sin_Cos_Tables();
     uav2D_init();
@@ -123,10 +169,49 @@ bool enabledAndShownOnPanel(uint16_t enabled, uint16_t panel) {
   return enabled == 1 && shownAtPanel(panel);
 }
 
+// Vehicle state of the frame being rendered, taken at frame start
+static const vehicle_state_t *vs;
+static uint64_t frame_ms;
+
+// Widgets show data of a group not updated for this time in warning color
+#define OSD_STALE_MS 3000
+
+/**
+ * widget_unchanged: draw a text widget from its cache if its source group
+ * didn't change and didn't become stale since it was drawn.
+ *
+ * @param       tc      text cache of the widget
+ * @param       version version of the group the widget shows
+ * @param       color   set to the widget color, warning color if data is stale
+ * @return      1 if the widget was drawn
+ */
+static int widget_unchanged(struct text_cache *tc, const vs_version_t *version, int *color)
+{
+  int stale = 0;
+
+  if (version->update_ms != 0) {
+    uint64_t stale_ms = version->update_ms + OSD_STALE_MS;
+    if (frame_ms >= stale_ms) {
+      stale = 1;
+    } else {
+      osd_schedule(stale_ms);
+    }
+  }
+
+  *color = stale ? 2 : 1;
+  return write_text_cache_unchanged(tc, version->changes << 1 | stale);
+}
+
 // TODO: try if this is performance critical or not
 char tmp_str[51] = { 0 };
 
 void RenderScreen(void) {
+  // Messages marked after this are drawn by the next frame
+  __atomic_store_n(&osd_dirty, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&osd_next_due, UINT64_MAX, __ATOMIC_RELAXED);
+  vs = vehicle_state_snapshot();
+  frame_ms = GetSystimeMS();
+
   do_converts();
 
   if (current_panel > osd_params.Max_panels) {
@@ -144,7 +229,7 @@ void RenderScreen(void) {
   draw_relative_altitude();
   draw_speed_scale();
   //draw_vtol_speed();
-  if (vtol_state == MAV_VTOL_STATE_TRANSITION_TO_FW || vtol_state == MAV_VTOL_STATE_FW || mav_type == MAV_TYPE_FIXED_WING)
+  if (vs->ext_sys_state.vtol_state == MAV_VTOL_STATE_TRANSITION_TO_FW || vs->ext_sys_state.vtol_state == MAV_VTOL_STATE_FW || vs->heartbeat.type == MAV_TYPE_FIXED_WING)
   {
     draw_ground_speed();
   }
@@ -187,12 +272,12 @@ void draw_osd_messages()
 
     int x = osd_params.OSDMessages_posX, y = osd_params.OSDMessages_posY;
     int i = 0;
-    int p = (osd_message_queue_tail + 1) % OSD_MAX_MESSAGES;
+    int p = (vs->statustext.tail + 1) % OSD_MAX_MESSAGES;
     int p_start = p;
 
     do
     {
-        osd_message_t *item = osd_message_queue + p;
+        const osd_message_t *item = vs->statustext.queue + p;
         if(item->message[0])
         {
             snprintf(tmp_str, sizeof(tmp_str), "%s", item->message);
@@ -211,15 +296,15 @@ void draw_simple_attitude() {
   int x = simple_attitude.x0;
   int y = simple_attitude.y0;
 
-  int line_mode = fabsf(osd_roll) < 90 ? 0 : 2;
-  int roll_color = fabsf(osd_roll) < 90 ? 1 : 2;
+  int line_mode = fabsf(vs->attitude.roll) < 90 ? 0 : 2;
+  int roll_color = fabsf(vs->attitude.roll) < 90 ? 1 : 2;
 
   write_line_outlined(x - radius - 1, y, x - 3 * radius - 1, y, 0, 0, 0, 1);
   write_line_outlined(x + radius - 1, y, x + 3 * radius + 1, y, 0, 0, 0, 1);
   write_line_outlined(x, y - radius - 1, x, y - 3 * radius, 0, 0, 0, 1);
   write_circle_outlined(x, y, radius, 0, 1, 0, 1, 1);
 
-  Transform_Polygon2D(&simple_attitude, -osd_roll, 0, osd_pitch);
+  Transform_Polygon2D(&simple_attitude, -vs->attitude.roll, 0, vs->attitude.pitch);
 
   for (int i = 0; i < simple_attitude.num_verts; i += 2) {
     write_line_outlined(simple_attitude.vlist_trans[i].x + x, simple_attitude.vlist_trans[i].y + y,
@@ -229,13 +314,13 @@ void draw_simple_attitude() {
 
   //draw pitch value
   y = simple_attitude.y0 - 20;
-  snprintf(tmp_str, sizeof(tmp_str), "PT %d", (int)osd_pitch);
+  snprintf(tmp_str, sizeof(tmp_str), "PT %d", (int)vs->attitude.pitch);
   write_string(tmp_str, x, y - 3, 0, 0, TEXT_VA_BOTTOM, TEXT_HA_CENTER, 0, SIZE_TO_FONT[1]);
 
   //draw roll value
   y = simple_attitude.y0 + 15;
 
-  snprintf(tmp_str, sizeof(tmp_str), "RL %d", (int)osd_roll);
+  snprintf(tmp_str, sizeof(tmp_str), "RL %d", (int)vs->attitude.roll);
   write_color_string(tmp_str, x, y + 5, 0, 0, TEXT_VA_TOP, TEXT_HA_CENTER, 0, SIZE_TO_FONT[1], roll_color);
 
 }
@@ -245,7 +330,11 @@ void draw_radar() {
   int index = 0;
 
   Reset_Polygon2D(&uav2D);
-  Transform_Polygon2D(&uav2D, -osd_roll, 0, osd_pitch);
+  Transform_Polygon2D(&uav2D, -vs->attitude.roll, 0, vs->attitude.pitch);
+
+  // horizon lines stay inside the attitude panel
+  push_clip_rect(osd_params.Atti_mp_posX - (int)(22 * atti_mp_scale), osd_params.Atti_mp_posY - (int)(30 * atti_mp_scale),
+                 osd_params.Atti_mp_posX + (int)(22 * atti_mp_scale), osd_params.Atti_mp_posY + (int)(34 * atti_mp_scale));
 
   // loop thru and draw a line from vertices 1 to n
   VECTOR4D v;
@@ -260,10 +349,11 @@ void draw_radar() {
     }
     index += 2;
   }   // end for
+  pop_clip_rect();
 
   //rotate roll scale and display, we only cal x
   Reset_Polygon2D(&rollscale2D);
-  Rotate_Polygon2D(&rollscale2D, -osd_roll);
+  Rotate_Polygon2D(&rollscale2D, -vs->attitude.roll);
   for (index = 0; index < rollscale2D.num_verts - 1; index++)
   {
     // draw line from ith to ith+1 vertex
@@ -284,7 +374,7 @@ void draw_radar() {
   write_line_outlined(x + wingEnd, y, x + wingStart, y, 2, 2, 0, 1);
 
   write_filled_rectangle_lm(x - 9, y + 6, 15, 9, 0, 1);
-  snprintf(tmp_str, sizeof(tmp_str), "%d", (int)osd_pitch);
+  snprintf(tmp_str, sizeof(tmp_str), "%d", (int)vs->attitude.pitch);
   write_string(tmp_str, x, y + 5, 0, 0, TEXT_VA_TOP, TEXT_HA_CENTER, 0, SIZE_TO_FONT[1]);
 
   y = osd_params.Atti_mp_posY - (int)(38.0f * atti_mp_scale);
@@ -292,16 +382,16 @@ void draw_radar() {
   write_line_outlined(x, y, x - 4, y + 8, 2, 2, 0, 1);
   write_line_outlined(x, y, x + 4, y + 8, 2, 2, 0, 1);
   write_line_outlined(x - 4, y + 8, x + 4, y + 8, 2, 2, 0, 1);
-  snprintf(tmp_str, sizeof(tmp_str), "%d", (int)osd_roll);
+  snprintf(tmp_str, sizeof(tmp_str), "%d", (int)vs->attitude.roll);
   write_string(tmp_str, x, y - 3, 0, 0, TEXT_VA_BOTTOM, TEXT_HA_CENTER, 0, SIZE_TO_FONT[1]);
 }
 
 void draw_home_direction() {
   if (!enabledAndShownOnPanel(osd_params.HomeDirection_enabled,
-                              osd_params.HomeDirection_panel) || !osd_got_home) {
+                              osd_params.HomeDirection_panel) || !vs->home.got_home) {
     return;
   }
-  float bearing = osd_home_bearing - osd_heading;
+  float bearing = osd_home_bearing - vs->vfr_hud.heading;
   Reset_Polygon2D(&home_direction);
   Reset_Polygon2D(&home_direction_outline);
   Rotate_Polygon2D(&home_direction, bearing);
@@ -311,15 +401,9 @@ void draw_home_direction() {
   const int y = home_direction.y0;
 
 
-  for (int i = 0; i < home_direction.num_verts; i += 2) {
-    write_line_lm(home_direction.vlist_trans[i].x + x,
-                  home_direction.vlist_trans[i].y + y,
-                  home_direction.vlist_trans[i + 1].x + x,
-                  home_direction.vlist_trans[i + 1].y + y,
-                  1, 1);
-  }
+  write_polygon2d_filled(&home_direction, 1, 1);
 
-  for (int i = 0; i < home_direction.num_verts; i += 2) {
+  for (int i = 0; i < home_direction_outline.num_verts; i += 2) {
     write_line_lm(home_direction_outline.vlist_trans[i].x + x,
                   home_direction_outline.vlist_trans[i].y + y,
                   home_direction_outline.vlist_trans[i + 1].x + x,
@@ -347,15 +431,14 @@ void draw_throttle(void) {
       return;
   }
 
-  int16_t pos_th_y, pos_th_x;
+  int16_t pos_th_y;
   int posX, posY;
   posX = osd_params.Throt_posX;
   posY = osd_params.Throt_posY;
 
   if (osd_params.Throt_scale_en) {
-    pos_th_y = (int16_t)(0.5 * osd_throttle);
-    pos_th_x = posX - 25 + pos_th_y;
-    snprintf(tmp_str, sizeof(tmp_str), "THR%3d%%", (int32_t)osd_throttle);
+    pos_th_y = (int16_t)(0.5 * vs->vfr_hud.throttle);
+    snprintf(tmp_str, sizeof(tmp_str), "THR%3d%%", (int32_t)vs->vfr_hud.throttle);
     write_string(tmp_str, posX, posY - 3, 0, 0, TEXT_VA_TOP, TEXT_HA_CENTER, 0, SIZE_TO_FONT[0]);
     if (osd_params.Throttle_Scale_Type == 0) {
       write_filled_rectangle_lm(posX + 3, posY + 25 - pos_th_y, 5, pos_th_y, 1, 1);
@@ -367,193 +450,269 @@ void draw_throttle(void) {
     else if (osd_params.Throttle_Scale_Type == 1) {
         write_rectangle_outlined(posX - 25, posY + 10, 50, 5, 0, 1);
         write_filled_rectangle_lm(posX - 25, posY + 10, pos_th_y, 5, 1, 1);
-      /* write_hline_lm(pos_th_x, posX + 25, posY + 10, 1, 1); */
-      /* write_hline_lm(pos_th_x, posX + 25, posY + 15, 1, 1); */
+      /* write_hline_lm(posX - 25 + pos_th_y, posX + 25, posY + 10, 1, 1); */
+      /* write_hline_lm(posX - 25 + pos_th_y, posX + 25, posY + 15, 1, 1); */
       /* write_vline_lm(posX + 25, posY + 10, posY + 15, 1, 1); */
       /* write_vline_lm(posX - 25, posY + 10, posY + 15, 1, 1); */
     }
   } else {
-    pos_th_y = (int16_t)(0.5 * osd_throttle);
-    snprintf(tmp_str, sizeof(tmp_str), "THR %3d%%", (int32_t)osd_throttle);
+    pos_th_y = (int16_t)(0.5 * vs->vfr_hud.throttle);
+    snprintf(tmp_str, sizeof(tmp_str), "THR %3d%%", (int32_t)vs->vfr_hud.throttle);
     write_string(tmp_str, posX, posY, 0, 0, TEXT_VA_TOP, TEXT_HA_RIGHT, 0, SIZE_TO_FONT[0]);
   }
 }
 
 void draw_home_latitude() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.HomeLatitude_enabled,
                               osd_params.HomeLatitude_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "H %0.6f", (double) osd_home_lat);
-  write_string(tmp_str, osd_params.HomeLatitude_posX,
-               osd_params.HomeLatitude_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.HomeLatitude_align, 0,
-               SIZE_TO_FONT[osd_params.HomeLatitude_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->home.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "H %0.6f", (double) vs->home.lat);
+  write_color_string_cached(&cache, tmp_str, osd_params.HomeLatitude_posX,
+                            osd_params.HomeLatitude_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.HomeLatitude_align, 0,
+                            SIZE_TO_FONT[osd_params.HomeLatitude_fontsize],
+                            color);
 }
 
 void draw_home_longitude() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.HomeLongitude_enabled,
                               osd_params.HomeLongitude_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "H %0.6f", (double) osd_home_lon);
-  write_string(tmp_str, osd_params.HomeLongitude_posX,
-               osd_params.HomeLongitude_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.HomeLongitude_align, 0,
-               SIZE_TO_FONT[osd_params.HomeLongitude_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->home.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "H %0.6f", (double) vs->home.lon);
+  write_color_string_cached(&cache, tmp_str, osd_params.HomeLongitude_posX,
+                            osd_params.HomeLongitude_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.HomeLongitude_align, 0,
+                            SIZE_TO_FONT[osd_params.HomeLongitude_fontsize],
+                            color);
 }
 
 void draw_gps_status() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.GpsStatus_en,
                               osd_params.GpsStatus_panel)) {
     return;
   }
 
-  int color = 1;
+  int color;
+  if (widget_unchanged(&cache, &vs->gps.version, &color)) {
+    return;
+  }
 
-  switch (osd_fix_type) {
+  switch (vs->gps.fix_type) {
   case NO_GPS:
   case NO_FIX:
     color = 2;
     snprintf(tmp_str, sizeof(tmp_str), "NOFIX");
     break;
   case GPS_OK_FIX_2D:
-    snprintf(tmp_str, sizeof(tmp_str), "2D-%d", (int) osd_satellites_visible);
+    snprintf(tmp_str, sizeof(tmp_str), "2D-%d", (int) vs->gps.satellites_visible);
     break;
   case GPS_OK_FIX_3D:
-    snprintf(tmp_str, sizeof(tmp_str), "3D-%d", (int) osd_satellites_visible);
+    snprintf(tmp_str, sizeof(tmp_str), "3D-%d", (int) vs->gps.satellites_visible);
     break;
   case GPS_OK_FIX_3D_DGPS:
-    snprintf(tmp_str, sizeof(tmp_str), "D3D-%d", (int) osd_satellites_visible);
+    snprintf(tmp_str, sizeof(tmp_str), "D3D-%d", (int) vs->gps.satellites_visible);
     break;
   default:
     color = 2;
     snprintf(tmp_str, sizeof(tmp_str), "NOGPS");
     break;
   }
-  write_color_string(tmp_str, osd_params.GpsStatus_posX,
-                     osd_params.GpsStatus_posY, 0, 0, TEXT_VA_TOP,
-                     osd_params.GpsStatus_align, 0,
-                     SIZE_TO_FONT[osd_params.GpsStatus_fontsize],
-                     color);
+  write_color_string_cached(&cache, tmp_str, osd_params.GpsStatus_posX,
+                            osd_params.GpsStatus_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.GpsStatus_align, 0,
+                            SIZE_TO_FONT[osd_params.GpsStatus_fontsize],
+                            color);
 }
 
 void draw_gps_hdop() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.GpsHDOP_en,
                               osd_params.GpsHDOP_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "HDOP %0.1f", (double) osd_hdop / 100.0f);
-  write_string(tmp_str, osd_params.GpsHDOP_posX,
-               osd_params.GpsHDOP_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.GpsHDOP_align, 0,
-               SIZE_TO_FONT[osd_params.GpsHDOP_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->gps.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "HDOP %0.1f", (double) vs->gps.hdop / 100.0f);
+  write_color_string_cached(&cache, tmp_str, osd_params.GpsHDOP_posX,
+                            osd_params.GpsHDOP_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.GpsHDOP_align, 0,
+                            SIZE_TO_FONT[osd_params.GpsHDOP_fontsize],
+                            color);
 }
 
 void draw_gps_latitude() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.GpsLat_en,
                               osd_params.GpsLat_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "%0.6f", (double) osd_lat);
-  write_string(tmp_str, osd_params.GpsLat_posX,
-               osd_params.GpsLat_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.GpsLat_align, 0,
-               SIZE_TO_FONT[osd_params.GpsLat_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->gps.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "%0.6f", (double) vs->gps.lat);
+  write_color_string_cached(&cache, tmp_str, osd_params.GpsLat_posX,
+                            osd_params.GpsLat_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.GpsLat_align, 0,
+                            SIZE_TO_FONT[osd_params.GpsLat_fontsize],
+                            color);
 }
 
 void draw_gps_longitude() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.GpsLon_en,
                               osd_params.GpsLon_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "%0.6f", (double) osd_lon);
-  write_string(tmp_str, osd_params.GpsLon_posX,
-               osd_params.GpsLon_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.GpsLon_align, 0,
-               SIZE_TO_FONT[osd_params.GpsLon_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->gps.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "%0.6f", (double) vs->gps.lon);
+  write_color_string_cached(&cache, tmp_str, osd_params.GpsLon_posX,
+                            osd_params.GpsLon_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.GpsLon_align, 0,
+                            SIZE_TO_FONT[osd_params.GpsLon_fontsize],
+                            color);
 }
 
 void draw_gps2_status() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.Gps2Status_en,
                               osd_params.Gps2Status_panel)) {
     return;
   }
 
-  int color = 1;
+  int color;
+  if (widget_unchanged(&cache, &vs->gps2.version, &color)) {
+    return;
+  }
 
-  switch (osd_fix_type2) {
+  switch (vs->gps2.fix_type) {
   case NO_GPS:
   case NO_FIX:
     color = 2;
     snprintf(tmp_str, sizeof(tmp_str), "NOFIX");
     break;
   case GPS_OK_FIX_2D:
-    snprintf(tmp_str, sizeof(tmp_str), "2D-%d", (int) osd_satellites_visible2);
+    snprintf(tmp_str, sizeof(tmp_str), "2D-%d", (int) vs->gps2.satellites_visible);
     break;
   case GPS_OK_FIX_3D:
-    snprintf(tmp_str, sizeof(tmp_str), "3D-%d", (int) osd_satellites_visible2);
+    snprintf(tmp_str, sizeof(tmp_str), "3D-%d", (int) vs->gps2.satellites_visible);
     break;
   case GPS_OK_FIX_3D_DGPS:
-    snprintf(tmp_str, sizeof(tmp_str), "D3D-%d", (int) osd_satellites_visible2);
+    snprintf(tmp_str, sizeof(tmp_str), "D3D-%d", (int) vs->gps2.satellites_visible);
     break;
   default:
     color = 2;
     snprintf(tmp_str, sizeof(tmp_str), "NOGPS");
     break;
   }
-  write_color_string(tmp_str, osd_params.Gps2Status_posX,
-                     osd_params.Gps2Status_posY, 0, 0, TEXT_VA_TOP,
-                     osd_params.Gps2Status_align, 0,
-                     SIZE_TO_FONT[osd_params.Gps2Status_fontsize],
-                     color);
+  write_color_string_cached(&cache, tmp_str, osd_params.Gps2Status_posX,
+                            osd_params.Gps2Status_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.Gps2Status_align, 0,
+                            SIZE_TO_FONT[osd_params.Gps2Status_fontsize],
+                            color);
 }
 
 void draw_gps2_hdop() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.Gps2HDOP_en,
                               osd_params.Gps2HDOP_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "HDOP %0.1f", (double) osd_hdop2 / 100.0f);
-  write_string(tmp_str, osd_params.Gps2HDOP_posX,
-               osd_params.Gps2HDOP_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.Gps2HDOP_align, 0,
-               SIZE_TO_FONT[osd_params.Gps2HDOP_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->gps2.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "HDOP %0.1f", (double) vs->gps2.hdop / 100.0f);
+  write_color_string_cached(&cache, tmp_str, osd_params.Gps2HDOP_posX,
+                            osd_params.Gps2HDOP_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.Gps2HDOP_align, 0,
+                            SIZE_TO_FONT[osd_params.Gps2HDOP_fontsize],
+                            color);
 }
 
 void draw_gps2_latitude() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.Gps2Lat_en,
                               osd_params.Gps2Lat_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "%0.6f", (double) osd_lat2);
-  write_string(tmp_str, osd_params.Gps2Lat_posX,
-               osd_params.Gps2Lat_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.Gps2Lat_align, 0,
-               SIZE_TO_FONT[osd_params.Gps2Lat_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->gps2.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "%0.6f", (double) vs->gps2.lat);
+  write_color_string_cached(&cache, tmp_str, osd_params.Gps2Lat_posX,
+                            osd_params.Gps2Lat_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.Gps2Lat_align, 0,
+                            SIZE_TO_FONT[osd_params.Gps2Lat_fontsize],
+                            color);
 }
 
 void draw_gps2_longitude() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.Gps2Lon_en,
                               osd_params.Gps2Lon_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "%0.6f", (double) osd_lon2);
-  write_string(tmp_str, osd_params.Gps2Lon_posX,
-               osd_params.Gps2Lon_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.Gps2Lon_align, 0,
-               SIZE_TO_FONT[osd_params.Gps2Lon_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->gps2.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "%0.6f", (double) vs->gps2.lon);
+  write_color_string_cached(&cache, tmp_str, osd_params.Gps2Lon_posX,
+                            osd_params.Gps2Lon_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.Gps2Lon_align, 0,
+                            SIZE_TO_FONT[osd_params.Gps2Lon_fontsize],
+                            color);
 }
 
 void draw_total_trip() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.TotalTripDist_en,
                               osd_params.TotalTripDist_panel)) {
     return;
@@ -566,13 +725,15 @@ void draw_total_trip() {
   else{
     snprintf(tmp_str, sizeof(tmp_str), "%0.2f%s", (double) (tmp / convert_distance_divider), dist_unit_long);
   }
-  write_string(tmp_str, osd_params.TotalTripDist_posX,
-               osd_params.TotalTripDist_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.TotalTripDist_align, 0,
-               SIZE_TO_FONT[osd_params.TotalTripDist_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.TotalTripDist_posX,
+                      osd_params.TotalTripDist_posY, 0, 0, TEXT_VA_TOP,
+                      osd_params.TotalTripDist_align, 0,
+                      SIZE_TO_FONT[osd_params.TotalTripDist_fontsize]);
 }
 
 void draw_time() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.Time_en,
                               osd_params.Time_panel)) {
     return;
@@ -581,10 +742,14 @@ void draw_time() {
   if(osd_debug)
   {
       snprintf(tmp_str, sizeof(tmp_str), "%lu", GetSystimeMS() % 1000000L);
+      osd_schedule(0);
   }
   else
   {
-      time_t t = time(NULL);
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+
+      time_t t = ts.tv_sec;
       struct tm *lt = localtime(&t);
 
       if (lt == NULL){
@@ -592,24 +757,29 @@ void draw_time() {
       }
 
       strftime(tmp_str, sizeof(tmp_str), "%H:%M:%S", lt);
+
+      // redraw when the second changes
+      osd_schedule(GetSystimeMS() + 1000 - ts.tv_nsec / 1000000);
   }
 
-  write_string(tmp_str, osd_params.Time_posX,
-               osd_params.Time_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.Time_align, 0,
-               SIZE_TO_FONT[osd_params.Time_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.Time_posX,
+                      osd_params.Time_posY, 0, 0, TEXT_VA_TOP,
+                      osd_params.Time_align, 0,
+                      SIZE_TO_FONT[osd_params.Time_fontsize]);
 }
 
 void draw_CWH(void) {
+  static struct text_cache cache[2];
+
   char tmp_str[100] = { 0 };
 
-  if(osd_got_home)
+  if(vs->home.got_home)
   {
       const double R = 6371e3; // metres
-      double f1 = osd_lat * D2R;  // convert to radians
-      double f2 = osd_home_lat * D2R;
+      double f1 = vs->gps.lat * D2R;  // convert to radians
+      double f2 = vs->home.lat * D2R;
       double df = f2 - f1;
-      double dl = (osd_home_lon - osd_lon) * D2R;
+      double dl = (vs->home.lon - vs->gps.lon) * D2R;
 
       // Haversine method
       // https://www.movable-type.co.uk/scripts/latlong.html
@@ -623,23 +793,23 @@ void draw_CWH(void) {
   }
 
   //distance
-  if (osd_params.CWH_home_dist_en == 1 && shownAtPanel(osd_params.CWH_home_dist_panel) && osd_got_home) {
+  if (osd_params.CWH_home_dist_en == 1 && shownAtPanel(osd_params.CWH_home_dist_panel) && vs->home.got_home) {
     float tmp = osd_home_distance * convert_distance;
     if (tmp < convert_distance_divider)
       snprintf(tmp_str, sizeof(tmp_str), "H: %d%s", (int)tmp, dist_unit_short);
     else
       snprintf(tmp_str, sizeof(tmp_str), "H: %0.2f%s", (double)(tmp / convert_distance_divider), dist_unit_long);
 
-    write_string(tmp_str, osd_params.CWH_home_dist_posX, osd_params.CWH_home_dist_posY, 0, 0, TEXT_VA_TOP, osd_params.CWH_home_dist_align, 0, SIZE_TO_FONT[osd_params.CWH_home_dist_fontsize]);
+    write_string_cached(&cache[0], tmp_str, osd_params.CWH_home_dist_posX, osd_params.CWH_home_dist_posY, 0, 0, TEXT_VA_TOP, osd_params.CWH_home_dist_align, 0, SIZE_TO_FONT[osd_params.CWH_home_dist_fontsize]);
   }
-  if ((wp_number != 0) && (osd_params.CWH_wp_dist_en) && shownAtPanel(osd_params.CWH_wp_dist_panel)) {
-    float tmp = wp_dist * convert_distance;
+  if ((vs->mission_current.wp_number != 0) && (osd_params.CWH_wp_dist_en) && shownAtPanel(osd_params.CWH_wp_dist_panel)) {
+    float tmp = vs->nav_controller.wp_dist * convert_distance;
     if (tmp < convert_distance_divider)
       snprintf(tmp_str, sizeof(tmp_str), "WP %d%s", (int)tmp, dist_unit_short);
     else
       snprintf(tmp_str, sizeof(tmp_str), "WP %0.2f%s", (double)(tmp / convert_distance_divider), dist_unit_long);
 
-    write_string(tmp_str, osd_params.CWH_wp_dist_posX, osd_params.CWH_wp_dist_posY, 0, 0, TEXT_VA_TOP, osd_params.CWH_wp_dist_align, 0, SIZE_TO_FONT[osd_params.CWH_wp_dist_fontsize]);
+    write_string_cached(&cache[1], tmp_str, osd_params.CWH_wp_dist_posX, osd_params.CWH_wp_dist_posY, 0, 0, TEXT_VA_TOP, osd_params.CWH_wp_dist_align, 0, SIZE_TO_FONT[osd_params.CWH_wp_dist_fontsize]);
   }
 
   //direction - map-like mode
@@ -649,7 +819,7 @@ void draw_CWH(void) {
 
   //direction - scale mode
   if (osd_params.CWH_Tmode_en == 1 && shownAtPanel(osd_params.CWH_Tmode_panel)) {
-      draw_linear_compass(osd_heading, osd_home_bearing, 120, 180, GRAPHICS_X_MIDDLE, osd_params.CWH_Tmode_posY, 15, 30, 5, 8, 0);
+      draw_linear_compass(vs->vfr_hud.heading, osd_home_bearing, 120, 180, osd_width / 2, osd_params.CWH_Tmode_posY, 15, 30, 5, 8, 0);
   }
 }
 
@@ -659,8 +829,8 @@ void draw_climb_rate() {
     return;
   }
 
-  float average_climb = roundf(10.0f * osd_climb) / 10.0f;
-  /* osd_climb_ma[osd_climb_ma_index] = osd_climb; */
+  float average_climb = roundf(10.0f * vs->vfr_hud.climb) / 10.0f;
+  /* osd_climb_ma[osd_climb_ma_index] = vs->vfr_hud.climb; */
   /* osd_climb_ma_index = (osd_climb_ma_index + 1) % 10; */
 
   /* for (int i = 0; i < 10; i++) { */
@@ -705,28 +875,30 @@ void draw_climb_rate() {
 }
 
 void draw_rssi() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.RSSI_en,
                               osd_params.RSSI_panel)) {
     return;
   }
 
-  int rssi = (int)osd_rssi;
+  int rssi = (int)vs->rc_channels.rssi;
 
   //Not from the MAVLINK, should take the RC channel PWM value.
   if (osd_params.RSSI_type != 0)
   {
-    if (osd_params.RSSI_type == 5) rssi = (int)osd_chan5_raw;
-    else if (osd_params.RSSI_type == 6) rssi = (int)osd_chan6_raw;
-    else if (osd_params.RSSI_type == 7) rssi = (int)osd_chan7_raw;
-    else if (osd_params.RSSI_type == 8) rssi = (int)osd_chan8_raw;
-    else if (osd_params.RSSI_type == 9) rssi = (int)osd_chan9_raw;
-    else if (osd_params.RSSI_type == 10) rssi = (int)osd_chan10_raw;
-    else if (osd_params.RSSI_type == 11) rssi = (int)osd_chan11_raw;
-    else if (osd_params.RSSI_type == 12) rssi = (int)osd_chan12_raw;
-    else if (osd_params.RSSI_type == 13) rssi = (int)osd_chan13_raw;
-    else if (osd_params.RSSI_type == 14) rssi = (int)osd_chan14_raw;
-    else if (osd_params.RSSI_type == 15) rssi = (int)osd_chan15_raw;
-    else if (osd_params.RSSI_type == 16) rssi = (int)osd_chan16_raw;
+    if (osd_params.RSSI_type == 5) rssi = (int)vs->rc_channels.chan_raw[4];
+    else if (osd_params.RSSI_type == 6) rssi = (int)vs->rc_channels.chan_raw[5];
+    else if (osd_params.RSSI_type == 7) rssi = (int)vs->rc_channels.chan_raw[6];
+    else if (osd_params.RSSI_type == 8) rssi = (int)vs->rc_channels.chan_raw[7];
+    else if (osd_params.RSSI_type == 9) rssi = (int)vs->rc_channels.chan_raw[8];
+    else if (osd_params.RSSI_type == 10) rssi = (int)vs->rc_channels.chan_raw[9];
+    else if (osd_params.RSSI_type == 11) rssi = (int)vs->rc_channels.chan_raw[10];
+    else if (osd_params.RSSI_type == 12) rssi = (int)vs->rc_channels.chan_raw[11];
+    else if (osd_params.RSSI_type == 13) rssi = (int)vs->rc_channels.chan_raw[12];
+    else if (osd_params.RSSI_type == 14) rssi = (int)vs->rc_channels.chan_raw[13];
+    else if (osd_params.RSSI_type == 15) rssi = (int)vs->rc_channels.chan_raw[14];
+    else if (osd_params.RSSI_type == 16) rssi = (int)vs->rc_channels.chan_raw[15];
   }
 
   //0:percentage 1:raw
@@ -755,13 +927,15 @@ void draw_rssi() {
     rc_lost = false;
   }
 
-  write_string(tmp_str, osd_params.RSSI_posX,
-               osd_params.RSSI_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.RSSI_align, 0,
-               SIZE_TO_FONT[osd_params.RSSI_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.RSSI_posX,
+                      osd_params.RSSI_posY, 0, 0, TEXT_VA_TOP,
+                      osd_params.RSSI_align, 0,
+                      SIZE_TO_FONT[osd_params.RSSI_fontsize]);
 }
 
 void draw_link_quality() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.LinkQuality_en,
                               osd_params.LinkQuality_panel)) {
     return;
@@ -771,18 +945,18 @@ void draw_link_quality() {
   int min = osd_params.LinkQuality_min;
   int max = osd_params.LinkQuality_max;
 
-  if (osd_params.LinkQuality_chan == 5) linkquality = (int)osd_chan5_raw;
-  else if (osd_params.LinkQuality_chan == 6) linkquality = (int)osd_chan6_raw;
-  else if (osd_params.LinkQuality_chan == 7) linkquality = (int)osd_chan7_raw;
-  else if (osd_params.LinkQuality_chan == 8) linkquality = (int)osd_chan8_raw;
-  else if (osd_params.LinkQuality_chan == 9) linkquality = (int)osd_chan9_raw;
-  else if (osd_params.LinkQuality_chan == 10) linkquality = (int)osd_chan10_raw;
-  else if (osd_params.LinkQuality_chan == 11) linkquality = (int)osd_chan11_raw;
-  else if (osd_params.LinkQuality_chan == 12) linkquality = (int)osd_chan12_raw;
-  else if (osd_params.LinkQuality_chan == 13) linkquality = (int)osd_chan13_raw;
-  else if (osd_params.LinkQuality_chan == 14) linkquality = (int)osd_chan14_raw;
-  else if (osd_params.LinkQuality_chan == 15) linkquality = (int)osd_chan15_raw;
-  else if (osd_params.LinkQuality_chan == 16) linkquality = (int)osd_chan16_raw;
+  if (osd_params.LinkQuality_chan == 5) linkquality = (int)vs->rc_channels.chan_raw[4];
+  else if (osd_params.LinkQuality_chan == 6) linkquality = (int)vs->rc_channels.chan_raw[5];
+  else if (osd_params.LinkQuality_chan == 7) linkquality = (int)vs->rc_channels.chan_raw[6];
+  else if (osd_params.LinkQuality_chan == 8) linkquality = (int)vs->rc_channels.chan_raw[7];
+  else if (osd_params.LinkQuality_chan == 9) linkquality = (int)vs->rc_channels.chan_raw[8];
+  else if (osd_params.LinkQuality_chan == 10) linkquality = (int)vs->rc_channels.chan_raw[9];
+  else if (osd_params.LinkQuality_chan == 11) linkquality = (int)vs->rc_channels.chan_raw[10];
+  else if (osd_params.LinkQuality_chan == 12) linkquality = (int)vs->rc_channels.chan_raw[11];
+  else if (osd_params.LinkQuality_chan == 13) linkquality = (int)vs->rc_channels.chan_raw[12];
+  else if (osd_params.LinkQuality_chan == 14) linkquality = (int)vs->rc_channels.chan_raw[13];
+  else if (osd_params.LinkQuality_chan == 15) linkquality = (int)vs->rc_channels.chan_raw[14];
+  else if (osd_params.LinkQuality_chan == 16) linkquality = (int)vs->rc_channels.chan_raw[15];
 
   // 0: percent, 1: raw
   if (osd_params.LinkQuality_type == 0) {
@@ -805,29 +979,31 @@ void draw_link_quality() {
     snprintf(tmp_str, sizeof(tmp_str), "LIQU %d", linkquality);
   }
 
-  write_string(tmp_str, osd_params.LinkQuality_posX,
-               osd_params.LinkQuality_posY, 0, 0, TEXT_VA_MIDDLE,
-               osd_params.LinkQuality_align, 0,
-               SIZE_TO_FONT[osd_params.LinkQuality_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.LinkQuality_posX,
+                      osd_params.LinkQuality_posY, 0, 0, TEXT_VA_MIDDLE,
+                      osd_params.LinkQuality_align, 0,
+                      SIZE_TO_FONT[osd_params.LinkQuality_fontsize]);
 }
 
 void draw_efficiency() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.Efficiency_en,
                               osd_params.Efficiency_panel)) {
     return;
   }
 
-  float wattage = osd_vbat_A * osd_curr_A * 0.01;
-  float speed = osd_groundspeed * convert_speed;
+  float wattage = vs->sys_status.vbat * vs->sys_status.current * 0.01;
+  float speed = vs->vfr_hud.groundspeed * convert_speed;
   float efficiency = 0;
   if (speed != 0) {
     efficiency = wattage / speed;
   }
   snprintf(tmp_str, sizeof(tmp_str), "%0.1fW/%s", efficiency, dist_unit_long);
 
-  write_string(tmp_str, osd_params.Efficiency_posX, osd_params.Efficiency_posY,
-               0, 0, TEXT_VA_TOP, osd_params.Efficiency_align, 0,
-               SIZE_TO_FONT[osd_params.Efficiency_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.Efficiency_posX, osd_params.Efficiency_posY,
+                      0, 0, TEXT_VA_TOP, osd_params.Efficiency_align, 0,
+                      SIZE_TO_FONT[osd_params.Efficiency_fontsize]);
 }
 
 void draw_panel_changed() {
@@ -837,8 +1013,9 @@ void draw_panel_changed() {
   }
 
   if ((GetSystimeMS() - new_panel_start_time) < 3000) {
+    osd_schedule(new_panel_start_time + 3000);
     snprintf(tmp_str, sizeof(tmp_str), "P %d", (int) current_panel);
-    write_string(tmp_str, GRAPHICS_X_MIDDLE, 210, 0, 0, TEXT_VA_TOP,
+    write_string(tmp_str, osd_width / 2, osd_height * 210 / GRAPHICS_HEIGHT, 0, 0, TEXT_VA_TOP,
                  TEXT_HA_CENTER, 0, SIZE_TO_FONT[1]);
   }
 }
@@ -926,7 +1103,7 @@ void draw_linear_compass(int v, int home_dir, int range, int width, int x, int y
     }
 
      // Put home direction
-     if (osd_got_home && rr == home_dir) {
+     if (vs->home.got_home && rr == home_dir) {
          xs = ((long int)(r * width) / (long int)range) + x;
          write_filled_rectangle_lm(xs - 5, majtick_start + textoffset + 7, 10, 10, 0, 1);
          write_string("H", xs + 1, majtick_start + textoffset + 12, 1, 0, TEXT_VA_MIDDLE, TEXT_HA_CENTER, 0, 2);
@@ -942,7 +1119,7 @@ void draw_linear_compass(int v, int home_dir, int range, int width, int x, int y
      /* } */
   }
 
-  if (osd_got_home && home_dir > 0 && !home_drawn) {
+  if (vs->home.got_home && home_dir > 0 && !home_drawn) {
      if (((v > home_dir) && (v - home_dir < 180)) || ((v < home_dir) && (home_dir -v > 180)))
      {
          r = x - ((long int)(range_2 * width) / (long int)range);
@@ -1194,7 +1371,7 @@ void draw_head_wp_home() {
   VECTOR2D_INITXYZ(&(suav.vlist_local[2]), 6, 14);
   VECTOR2D_INITXYZ(&(suav.vlist_local[3]), 0, 10);
   Reset_Polygon2D(&suav);
-  Rotate_Polygon2D(&suav, osd_heading);
+  Rotate_Polygon2D(&suav, vs->vfr_hud.heading);
 
   write_line_outlined(suav.vlist_trans[0].x + suav.x0, suav.vlist_trans[0].y + suav.y0,
                       suav.vlist_trans[1].x + suav.x0, suav.vlist_trans[1].y + suav.y0, 2, 2, 0, 1);
@@ -1215,13 +1392,13 @@ void draw_head_wp_home() {
   }
 
   //draw waypoint
-  if ((wp_number != 0) && (wp_dist > 1))
+  if ((vs->mission_current.wp_number != 0) && (vs->nav_controller.wp_dist > 1))
   {
     //format bearing
-    wp_target_bearing = (wp_target_bearing + 360) % 360;
+    int16_t wp_target_bearing = (vs->nav_controller.target_bearing + 360) % 360;
     float wpCX = posX + (osd_params.CWH_Nmode_wp_radius) * Fast_Sin(wp_target_bearing);
     float wpCY = posY - (osd_params.CWH_Nmode_wp_radius) * Fast_Cos(wp_target_bearing);
-    snprintf(tmp_str, sizeof(tmp_str), "%d", (int)wp_number + 1);
+    snprintf(tmp_str, sizeof(tmp_str), "%d", (int)vs->mission_current.wp_number + 1);
     write_string(tmp_str, wpCX, wpCY, 0, 0, TEXT_VA_MIDDLE, TEXT_HA_CENTER, 0, SIZE_TO_FONT[0]);
   }
 }
@@ -1250,6 +1427,9 @@ void draw_wind(void) {
   VECTOR2D_INITXYZ(&(obj2D.vlist_local[4]), 0, -2);
   Reset_Polygon2D(&obj2D);
   Rotate_Polygon2D(&obj2D, osd_windDir);
+  write_triangle_filled(obj2D.vlist_trans[0].x + obj2D.x0, obj2D.vlist_trans[0].y + obj2D.y0,
+                        obj2D.vlist_trans[1].x + obj2D.x0, obj2D.vlist_trans[1].y + obj2D.y0,
+                        obj2D.vlist_trans[2].x + obj2D.x0, obj2D.vlist_trans[2].y + obj2D.y0);
   write_triangle_wire(obj2D.vlist_trans[0].x + obj2D.x0, obj2D.vlist_trans[0].y + obj2D.y0,
                       obj2D.vlist_trans[1].x + obj2D.x0, obj2D.vlist_trans[1].y + obj2D.y0,
                       obj2D.vlist_trans[2].x + obj2D.x0, obj2D.vlist_trans[2].y + obj2D.y0);
@@ -1263,24 +1443,26 @@ void draw_wind(void) {
 }
 
 void draw_warning(void) {
+  static struct text_cache cache;
+
   bool haswarn = false;
   uint8_t warning[8] = {};
 
   //no GPS fix!
-  if (osd_params.Alarm_GPS_status_en == 1 && (osd_fix_type < GPS_OK_FIX_3D)) {
+  if (osd_params.Alarm_GPS_status_en == 1 && (vs->gps.fix_type < GPS_OK_FIX_3D)) {
     haswarn = true;
     warning[0] = 1;
   }
 
   //low batt
-  if (osd_params.Alarm_low_batt_en == 1 && (osd_battery_remaining_A < osd_params.Alarm_low_batt)) {
+  if (osd_params.Alarm_low_batt_en == 1 && (vs->sys_status.battery_remaining < osd_params.Alarm_low_batt)) {
     haswarn = true;
     warning[1] = 1;
   }
 
-  float spd_comparison = osd_groundspeed;
+  float spd_comparison = vs->vfr_hud.groundspeed;
   if (osd_params.Spd_Scale_type == 1) {
-    spd_comparison = osd_airspeed;
+    spd_comparison = vs->vfr_hud.airspeed;
   }
   spd_comparison *= convert_speed;
   //under speed
@@ -1296,9 +1478,9 @@ void draw_warning(void) {
     warning[3] = 1;
   }
 
-  float alt_comparison = osd_rel_alt;
+  float alt_comparison = vs->altitude.rel_alt;
   if (osd_params.Alt_Scale_type == 0) {
-    alt_comparison = osd_alt;
+    alt_comparison = vs->vfr_hud.alt;
   }
   //under altitude
   if (osd_params.Alarm_low_alt_en == 1 && (alt_comparison < osd_params.Alarm_low_alt)) {
@@ -1313,7 +1495,7 @@ void draw_warning(void) {
   }
 
   // no home yet
-  if (osd_got_home == 0) {
+  if (vs->home.got_home == 0) {
     haswarn = true;
     warning[6] = 1;
   }
@@ -1373,8 +1555,13 @@ void draw_warning(void) {
       last_warn_time = 0;
       strcpy(warn_str, "");
   }
+  else
+  {
+      // next warning is shown in a second
+      osd_schedule(last_warn_time + 1000);
+  }
 
-  write_color_string(warn_str, osd_params.Alarm_posX, osd_params.Alarm_posY, 0, 0, TEXT_VA_TOP, osd_params.Alarm_align, 0, SIZE_TO_FONT[osd_params.Alarm_fontsize], 2);
+  write_color_string_cached(&cache, warn_str, osd_params.Alarm_posX, osd_params.Alarm_posY, 0, 0, TEXT_VA_TOP, osd_params.Alarm_align, 0, SIZE_TO_FONT[osd_params.Alarm_fontsize], 2);
 }
 
 
@@ -1524,6 +1711,8 @@ char *ardupilot_modes_plane(int mode)
 }
 
 void draw_flight_mode() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.FlightMode_en,
                               osd_params.FlightMode_panel)) {
     return;
@@ -1531,21 +1720,21 @@ void draw_flight_mode() {
 
   char* mode_str = "UNKNOWN";
 
-  switch (autopilot)
+  switch (vs->heartbeat.autopilot)
   {
   case MAV_AUTOPILOT_ARDUPILOTMEGA:       //ardupilotmega
       {
-          if (mav_type == MAV_TYPE_FIXED_WING)
-              mode_str = ardupilot_modes_plane(custom_mode);
+          if (vs->heartbeat.type == MAV_TYPE_FIXED_WING)
+              mode_str = ardupilot_modes_plane(vs->heartbeat.custom_mode);
           else
-              mode_str = ardupilot_modes_copter(custom_mode);
+              mode_str = ardupilot_modes_copter(vs->heartbeat.custom_mode);
       }
       break;
 
   case MAV_AUTOPILOT_PX4:
       {
           union px4_custom_mode custom_mode_px4;
-          custom_mode_px4.data = custom_mode;
+          custom_mode_px4.data = vs->heartbeat.custom_mode;
 
           switch(custom_mode_px4.main_mode)
           {
@@ -1610,80 +1799,115 @@ void draw_flight_mode() {
       break;
   }
 
-  int color = (!motor_armed || wfb_errors > 0 || wfb_flags & (WFB_LINK_LOST | WFB_LINK_JAMMED)) ? 2 : 1;
+  int color = (!vs->heartbeat.motor_armed || vs->radio_status.errors > 0 || vs->radio_status.flags & (WFB_LINK_LOST | WFB_LINK_JAMMED)) ? 2 : 1;
 
-  write_color_string(mode_str, osd_params.FlightMode_posX, osd_params.FlightMode_posY,
-                     0, 0, TEXT_VA_TOP, osd_params.FlightMode_align, 0,
-                     SIZE_TO_FONT[osd_params.FlightMode_fontsize],
-                     color);
+  write_color_string_cached(&cache, mode_str, osd_params.FlightMode_posX, osd_params.FlightMode_posY,
+                            0, 0, TEXT_VA_TOP, osd_params.FlightMode_align, 0,
+                            SIZE_TO_FONT[osd_params.FlightMode_fontsize],
+                            color);
 }
 
 void draw_arm_state() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.Arm_en,
                               osd_params.Arm_panel)) {
     return;
   }
 
-  char* tmp_str1 = motor_armed ? "ARMED" : "DISARMED";
-  write_color_string(tmp_str1, osd_params.Arm_posX,
-                     osd_params.Arm_posY, 0, 0, TEXT_VA_TOP,
-                     osd_params.Arm_align, 0,
-                     SIZE_TO_FONT[osd_params.Arm_fontsize],
-                     motor_armed ? 1 : 2);
+  char* tmp_str1 = vs->heartbeat.motor_armed ? "ARMED" : "DISARMED";
+  write_color_string_cached(&cache, tmp_str1, osd_params.Arm_posX,
+                            osd_params.Arm_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.Arm_align, 0,
+                            SIZE_TO_FONT[osd_params.Arm_fontsize],
+                            vs->heartbeat.motor_armed ? 1 : 2);
 }
 
 void draw_battery_voltage() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.BattVolt_en,
                               osd_params.BattVolt_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "%4.1fV", (double) osd_vbat_A);
-  write_string(tmp_str, osd_params.BattVolt_posX,
-               osd_params.BattVolt_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.BattVolt_align, 0,
-               SIZE_TO_FONT[osd_params.BattVolt_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->sys_status.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "%4.1fV", (double) vs->sys_status.vbat);
+  write_color_string_cached(&cache, tmp_str, osd_params.BattVolt_posX,
+                            osd_params.BattVolt_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.BattVolt_align, 0,
+                            SIZE_TO_FONT[osd_params.BattVolt_fontsize],
+                            color);
 }
 
 void draw_battery_current() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.BattCurrent_en,
                               osd_params.BattCurrent_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "%5.1fA", (double) (osd_curr_A * 0.01));
-  write_string(tmp_str, osd_params.BattCurrent_posX,
-               osd_params.BattCurrent_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.BattCurrent_align, 0,
-               SIZE_TO_FONT[osd_params.BattCurrent_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->sys_status.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "%5.1fA", (double) (vs->sys_status.current * 0.01));
+  write_color_string_cached(&cache, tmp_str, osd_params.BattCurrent_posX,
+                            osd_params.BattCurrent_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.BattCurrent_align, 0,
+                            SIZE_TO_FONT[osd_params.BattCurrent_fontsize],
+                            color);
 }
 
 void draw_battery_remaining() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.BattRemaining_en,
                               osd_params.BattRemaining_panel)) {
     return;
   }
 
-  int color = osd_battery_remaining_A < 20 ? 2 : 1;
-  snprintf(tmp_str, sizeof(tmp_str), "%3d%%", osd_battery_remaining_A);
-  write_color_string(tmp_str, osd_params.BattRemaining_posX,
-                     osd_params.BattRemaining_posY, 0, 0, TEXT_VA_TOP,
-                     osd_params.BattRemaining_align, 0,
-                     SIZE_TO_FONT[osd_params.BattRemaining_fontsize],
-                     color);
+  int color;
+  if (widget_unchanged(&cache, &vs->sys_status.version, &color)) {
+    return;
+  }
+
+  if (vs->sys_status.battery_remaining < 20) {
+    color = 2;
+  }
+  snprintf(tmp_str, sizeof(tmp_str), "%3d%%", vs->sys_status.battery_remaining);
+  write_color_string_cached(&cache, tmp_str, osd_params.BattRemaining_posX,
+                            osd_params.BattRemaining_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.BattRemaining_align, 0,
+                            SIZE_TO_FONT[osd_params.BattRemaining_fontsize],
+                            color);
 }
 
 void draw_battery_consumed() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.BattConsumed_en,
                               osd_params.BattConsumed_panel)) {
     return;
   }
 
-  snprintf(tmp_str, sizeof(tmp_str), "%dmah", (int)osd_curr_consumed_mah);
-  write_string(tmp_str, osd_params.BattConsumed_posX,
-               osd_params.BattConsumed_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.BattConsumed_align, 0,
-               SIZE_TO_FONT[osd_params.BattConsumed_fontsize]);
+  int color;
+  if (widget_unchanged(&cache, &vs->battery_status.version, &color)) {
+    return;
+  }
+
+  snprintf(tmp_str, sizeof(tmp_str), "%dmah", (int)vs->battery_status.current_consumed);
+  write_color_string_cached(&cache, tmp_str, osd_params.BattConsumed_posX,
+                            osd_params.BattConsumed_posY, 0, 0, TEXT_VA_TOP,
+                            osd_params.BattConsumed_align, 0,
+                            SIZE_TO_FONT[osd_params.BattConsumed_fontsize],
+                            color);
 }
 
 void draw_wfb_state() {
@@ -1694,24 +1918,24 @@ void draw_wfb_state() {
 
   int color = 1;
 
-  if (wfb_flags & WFB_LINK_LOST)
+  if (vs->radio_status.flags & WFB_LINK_LOST)
   {
       color = 2;
       snprintf(tmp_str, sizeof(tmp_str), "WFB LINK LOST");
   }
-  else if (wfb_flags & WFB_LINK_JAMMED)
+  else if (vs->radio_status.flags & WFB_LINK_JAMMED)
   {
       color = 2;
-      snprintf(tmp_str, sizeof(tmp_str), "WFB %3d JAMMED", wfb_rssi);
+      snprintf(tmp_str, sizeof(tmp_str), "WFB %3d JAMMED", vs->radio_status.rssi);
   }
   else
   {
-      if(wfb_errors > 0)
+      if(vs->radio_status.errors > 0)
       {
         color = 2;
       }
 
-      snprintf(tmp_str, sizeof(tmp_str), "WFB %3d F%d L%d", wfb_rssi, wfb_fec_fixed, wfb_errors);
+      snprintf(tmp_str, sizeof(tmp_str), "WFB %3d F%d L%d", vs->radio_status.rssi, vs->radio_status.fec_fixed, vs->radio_status.errors);
   }
 
   write_color_string(tmp_str,
@@ -1733,15 +1957,15 @@ void draw_altitude_scale() {
   float alt_shown;
   float min_alt = 10;
 
-  if (!isnan(osd_bottom_clearance)){
-      alt_shown = osd_bottom_clearance;
+  if (!isnan(vs->altitude.bottom_clearance)){
+      alt_shown = vs->altitude.bottom_clearance;
       snprintf(tmp_str, sizeof(tmp_str), "AGL");
   }else{
       if (osd_params.Alt_Scale_type == 0) {
-          alt_shown = osd_alt;
+          alt_shown = vs->vfr_hud.alt;
           snprintf(tmp_str, sizeof(tmp_str), "MSL");
       }else{
-          alt_shown = osd_rel_alt;
+          alt_shown = vs->altitude.rel_alt;
           snprintf(tmp_str, sizeof(tmp_str), "REL");
       }
   }
@@ -1774,12 +1998,14 @@ void draw_altitude_scale() {
 }
 
 void draw_absolute_altitude() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.TALT_en,
                               osd_params.TALT_panel)) {
     return;
   }
 
-  float tmp = osd_alt * convert_distance;
+  float tmp = vs->vfr_hud.alt * convert_distance;
   if (tmp < convert_distance_divider) {
     snprintf(tmp_str, sizeof(tmp_str), "AA %d%s", (int) tmp, dist_unit_short);
   }
@@ -1787,19 +2013,21 @@ void draw_absolute_altitude() {
     snprintf(tmp_str, sizeof(tmp_str), "AA %0.2f%s", (double) (tmp / convert_distance_divider), dist_unit_long);
   }
 
-  write_string(tmp_str, osd_params.TALT_posX,
-               osd_params.TALT_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.TALT_align, 0,
-               SIZE_TO_FONT[osd_params.TALT_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.TALT_posX,
+                      osd_params.TALT_posY, 0, 0, TEXT_VA_TOP,
+                      osd_params.TALT_align, 0,
+                      SIZE_TO_FONT[osd_params.TALT_fontsize]);
 }
 
 void draw_relative_altitude() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.Relative_ALT_en,
                               osd_params.Relative_ALT_panel)) {
     return;
   }
 
-  float tmp = osd_rel_alt * convert_distance;
+  float tmp = vs->altitude.rel_alt * convert_distance;
   if (tmp < convert_distance_divider) {
     snprintf(tmp_str, sizeof(tmp_str), "A %d%s", (int) tmp, dist_unit_short);
   }
@@ -1807,13 +2035,15 @@ void draw_relative_altitude() {
     snprintf(tmp_str, sizeof(tmp_str), "A %0.2f%s", (double) (tmp / convert_distance_divider), dist_unit_long);
   }
 
-  write_string(tmp_str, osd_params.Relative_ALT_posX,
-               osd_params.Relative_ALT_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.Relative_ALT_align, 0,
-               SIZE_TO_FONT[osd_params.Relative_ALT_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.Relative_ALT_posX,
+                      osd_params.Relative_ALT_posY, 0, 0, TEXT_VA_TOP,
+                      osd_params.Relative_ALT_align, 0,
+                      SIZE_TO_FONT[osd_params.Relative_ALT_fontsize]);
 }
 
 void draw_speed_scale() {
+  static struct text_cache cache[2];
+
   if (!enabledAndShownOnPanel(osd_params.Speed_scale_en,
                               osd_params.Speed_scale_panel)) {
       return;
@@ -1823,14 +2053,14 @@ void draw_speed_scale() {
   float vmin = -1;
   int  flags = HUD_VSCALE_FLAG_NO_NEGATIVE;
 
-  if (vtol_state == MAV_VTOL_STATE_TRANSITION_TO_FW || vtol_state == MAV_VTOL_STATE_FW || mav_type == MAV_TYPE_FIXED_WING)
+  if (vs->ext_sys_state.vtol_state == MAV_VTOL_STATE_TRANSITION_TO_FW || vs->ext_sys_state.vtol_state == MAV_VTOL_STATE_FW || vs->heartbeat.type == MAV_TYPE_FIXED_WING)
   {
-      spd_shown = osd_airspeed;
+      spd_shown = vs->vfr_hud.airspeed;
       snprintf(tmp_str, sizeof(tmp_str), "AS");
       // Set min airspeed 15 km/h
       vmin = 15;
   } else {
-      spd_shown = osd_groundspeed;
+      spd_shown = vs->vfr_hud.groundspeed;
       snprintf(tmp_str, sizeof(tmp_str), "GS");
   }
 
@@ -1841,64 +2071,70 @@ void draw_speed_scale() {
 		      5, 10, 5, 8, 11,
                       100, flags, vmin);
 
-  write_string(tmp_str, osd_params.Speed_scale_posX,
-               osd_params.Speed_scale_posY - 70 - 15, 0, 0, TEXT_VA_TOP,
-               osd_params.Speed_scale_align, 0,
-               SIZE_TO_FONT[0]);
+  write_string_cached(&cache[0], tmp_str, osd_params.Speed_scale_posX,
+                      osd_params.Speed_scale_posY - 70 - 15, 0, 0, TEXT_VA_TOP,
+                      osd_params.Speed_scale_align, 0,
+                      SIZE_TO_FONT[0]);
 
   snprintf(tmp_str, sizeof(tmp_str), "[%s]", spd_unit);
-  write_string(tmp_str, osd_params.Speed_scale_posX,
-               osd_params.Speed_scale_posY + 60 + 20, 0, 0, TEXT_VA_TOP,
-               osd_params.Speed_scale_align, 0,
-               SIZE_TO_FONT[0]);
+  write_string_cached(&cache[1], tmp_str, osd_params.Speed_scale_posX,
+                      osd_params.Speed_scale_posY + 60 + 20, 0, 0, TEXT_VA_TOP,
+                      osd_params.Speed_scale_align, 0,
+                      SIZE_TO_FONT[0]);
 }
 
 void draw_ground_speed() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.TSPD_en,
                               osd_params.TSPD_panel)) {
     return;
   }
 
-  float tmp = osd_groundspeed * convert_speed;
+  float tmp = vs->vfr_hud.groundspeed * convert_speed;
   snprintf(tmp_str, sizeof(tmp_str), "GS: %d", (int) tmp);
-  write_string(tmp_str, osd_params.TSPD_posX,
-               osd_params.TSPD_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.TSPD_align, 0,
-               SIZE_TO_FONT[osd_params.TSPD_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.TSPD_posX,
+                      osd_params.TSPD_posY, 0, 0, TEXT_VA_TOP,
+                      osd_params.TSPD_align, 0,
+                      SIZE_TO_FONT[osd_params.TSPD_fontsize]);
 }
 
 void draw_air_speed() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.Air_Speed_en,
                               osd_params.Air_Speed_panel)) {
     return;
   }
 
-  float tmp = osd_airspeed * convert_speed;
+  float tmp = vs->vfr_hud.airspeed * convert_speed;
   snprintf(tmp_str, sizeof(tmp_str), "AS %d%s", (int) tmp, spd_unit);
-  write_string(tmp_str, osd_params.Air_Speed_posX,
-               osd_params.Air_Speed_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.Air_Speed_align, 0,
-               SIZE_TO_FONT[osd_params.Air_Speed_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.Air_Speed_posX,
+                      osd_params.Air_Speed_posY, 0, 0, TEXT_VA_TOP,
+                      osd_params.Air_Speed_align, 0,
+                      SIZE_TO_FONT[osd_params.Air_Speed_fontsize]);
 }
 
 void draw_vtol_speed() {
+  static struct text_cache cache;
+
   if (!enabledAndShownOnPanel(osd_params.TSPD_en,
                               osd_params.TSPD_panel)) {
     return;
   }
 
   float tmp;
-  if (vtol_state == MAV_VTOL_STATE_TRANSITION_TO_FW || vtol_state == MAV_VTOL_STATE_FW)
+  if (vs->ext_sys_state.vtol_state == MAV_VTOL_STATE_TRANSITION_TO_FW || vs->ext_sys_state.vtol_state == MAV_VTOL_STATE_FW)
   {
-      tmp = osd_airspeed * convert_speed;
+      tmp = vs->vfr_hud.airspeed * convert_speed;
       snprintf(tmp_str, sizeof(tmp_str), "AS: %d %s", (int) tmp, spd_unit);
   } else {
-      tmp = osd_groundspeed * convert_speed;
+      tmp = vs->vfr_hud.groundspeed * convert_speed;
       snprintf(tmp_str, sizeof(tmp_str), "GS: %d %s", (int) tmp, spd_unit);
   }
 
-  write_string(tmp_str, osd_params.TSPD_posX,
-               osd_params.TSPD_posY, 0, 0, TEXT_VA_TOP,
-               osd_params.TSPD_align, 0,
-               SIZE_TO_FONT[osd_params.TSPD_fontsize]);
+  write_string_cached(&cache, tmp_str, osd_params.TSPD_posX,
+                      osd_params.TSPD_posY, 0, 0, TEXT_VA_TOP,
+                      osd_params.TSPD_align, 0,
+                      SIZE_TO_FONT[osd_params.TSPD_fontsize]);
 }
@@ -32,7 +32,11 @@ enum GPS_Status {
 };
 
 
+uint64_t GetSystimeNS(void);
 uint64_t GetSystimeMS(void);
+void osd_mark_dirty(void);
+void osd_schedule(uint64_t due_ms);
+uint64_t osd_next_frame_ms(void);
 void RenderScreen(void);
 
 void draw_uav3d(void);
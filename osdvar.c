@@ -17,101 +17,88 @@
  * With Grateful Acknowledgements to the projects:
  * MinimOSD - arducam-osd Controller(https://code.google.com/p/arducam-osd/)
  */
+#include <string.h>
+
 #include "osdvar.h"
 
+#define VEHICLE_STATE_INIT {                                \
+    .vfr_hud = { .airspeed = -1.0f },                       \
+    .altitude = { .bottom_clearance = NAN },                \
+    .radio_status = { .rssi = -128, .flags = WFB_LINK_LOST }, \
+    .statustext = { .tail = -1 },                           \
+}
+
+// Parser's working copy
+vehicle_state_t vehicle_state = VEHICLE_STATE_INIT;
+
+// Triple buffer between parser and renderer. Parser owns vs_back, renderer
+// owns vs_front, vs_middle holds the latest published state and is swapped
+// atomically. VS_FRESH is set in vs_middle when it wasn't read yet.
+#define VS_INDEX_MASK   0x3
+#define VS_FRESH        0x4
+
+static vehicle_state_t vs_slots[3] = { VEHICLE_STATE_INIT, VEHICLE_STATE_INIT, VEHICLE_STATE_INIT };
+static unsigned vs_back = 0;
+static unsigned vs_middle = 1;
+static unsigned vs_front = 2;
+
+/**
+ * vehicle_state_touch: update version of a group after its source message
+ * was decoded.
+ *
+ * @param       version         version of the group
+ * @param       prev, group     group before and after the update
+ * @param       size            size of the group
+ * @param       now_ms          GetSystimeMS() time of the update
+ */
+void vehicle_state_touch(vs_version_t *version, const void *prev, const void *group, size_t size, uint64_t now_ms)
+{
+    if (memcmp(prev, group, size) != 0)
+    {
+        version->changes++;
+    }
+    version->update_ms = now_ms;
+}
+
+/**
+ * vehicle_state_publish: make current vehicle_state visible to the renderer.
+ * Never blocks, called by the parser after a complete update.
+ */
+void vehicle_state_publish(void)
+{
+    memcpy(&vs_slots[vs_back], &vehicle_state, sizeof(vehicle_state));
+    vs_back = __atomic_exchange_n(&vs_middle, vs_back | VS_FRESH, __ATOMIC_ACQ_REL) & VS_INDEX_MASK;
+}
+
+/**
+ * vehicle_state_snapshot: latest published vehicle state. Never blocks,
+ * returned state stays unchanged until the next call.
+ */
+const vehicle_state_t *vehicle_state_snapshot(void)
+{
+    if (__atomic_load_n(&vs_middle, __ATOMIC_ACQUIRE) & VS_FRESH)
+    {
+        vs_front = __atomic_exchange_n(&vs_middle, vs_front, __ATOMIC_ACQ_REL) & VS_INDEX_MASK;
+    }
+    return &vs_slots[vs_front];
+}
+
 /////////////////////////////////////////////////////////////////////////
 uint64_t lastWritePanel = 0;
-uint8_t mav_type;
-uint8_t mav_system;
-uint8_t mav_component;
 uint64_t sys_start_time = 0;
-uint64_t armed_start_time = 0;
-uint64_t total_armed_time = 0;
-uint8_t vtol_state = 0;
 
 /////////////////////////////////////////////////////////////////////////
-float osd_vbat_A = 0.0f;                 // Battery A voltage in milivolt
-int16_t osd_curr_A = 0;                 // Battery A current
-int8_t osd_battery_remaining_A = 0;    // 0 to 100 <=> 0 to 1000
-uint32_t osd_curr_consumed_mah = 0;
-
-float osd_pitch = 0.0f;                  // pitch from DCM
-float osd_roll = 0.0f;                   // roll from DCM
-float osd_yaw = 0.0f;                    // relative heading form DCM
-float osd_heading = 0.0f;                // ground course heading from GPS
-
-double osd_lat = 0.0f;                    // latidude
-double osd_lon = 0.0f;                    // longitude
-uint8_t osd_satellites_visible = 0;     // number of satelites
-uint8_t osd_fix_type = 0;               // GPS lock 0-1=no fix, 2=2D, 3=3D
-double osd_hdop = 0.0f;
-
-double osd_lat2 = 0.0f;                    // latidude
-double osd_lon2 = 0.0f;                    // longitude
-uint8_t osd_satellites_visible2 = 0;     // number of satelites
-uint8_t osd_fix_type2 = 0;               // GPS lock 0-1=no fix, 2=2D, 3=3D
-double osd_hdop2 = 0.0f;
-
-float osd_airspeed = -1.0f;              // airspeed
-float osd_groundspeed = 0.0f;            // ground speed
 float osd_downVelocity = 0.0f;
-uint16_t osd_throttle = 0;               // throtle
-float osd_alt = 0.0f;                    // altitude
-float osd_rel_alt = 0.0f;                                // relative altitude	//  jmmods
-float osd_bottom_clearance = NAN;
-float osd_climb = 0.0f;
 float osd_climb_ma[10];
 int osd_climb_ma_index = 0;
 float osd_total_trip_dist = 0;
 
-float nav_roll = 0.0f; // Current desired roll in degrees
-float nav_pitch = 0.0f; // Current desired pitch in degrees
-int16_t nav_bearing = 0; // Current desired heading in degrees
-int16_t wp_target_bearing = 0; // Bearing to current MISSION/target in degrees
 int8_t wp_target_bearing_rotate_int = 0;
-uint16_t wp_dist = 0; // Distance to active MISSION in meters
-uint8_t wp_number = 0; // Current waypoint number
-float alt_error = 0.0f; // Current altitude error in meters
-float aspd_error = 0.0f; // Current airspeed error in meters/second
-float xtrack_error = 0.0f; // Current crosstrack error on x-y plane in meters
 float eff = 0.0f; //Efficiency
 uint8_t osd_linkquality = 0;
 
-bool motor_armed = false;
-bool last_motor_armed = false;
-uint8_t autopilot = 0;
-uint8_t base_mode = 0;
-uint32_t custom_mode = 0;
-
-bool osd_chan_cnt_above_eight = false;
-uint16_t osd_chan1_raw = 0;
-uint16_t osd_chan2_raw = 0;
-uint16_t osd_chan3_raw = 0;
-uint16_t osd_chan4_raw = 0;
-uint16_t osd_chan5_raw = 0;
-uint16_t osd_chan6_raw = 0;
-uint16_t osd_chan7_raw = 0;
-uint16_t osd_chan8_raw = 0;
-uint16_t osd_chan9_raw = 0;
-uint16_t osd_chan10_raw = 0;
-uint16_t osd_chan11_raw = 0;
-uint16_t osd_chan12_raw = 0;
-uint16_t osd_chan13_raw = 0;
-uint16_t osd_chan14_raw = 0;
-uint16_t osd_chan15_raw = 0;
-uint16_t osd_chan16_raw = 0;
-uint8_t osd_rssi = 0; //raw value from mavlink
-
-int8_t wfb_rssi = -128; //WFB rssi -128dBm
-uint16_t wfb_errors = 0;
-uint16_t wfb_fec_fixed = 0;
-int8_t wfb_flags = WFB_LINK_LOST;
 bool rc_lost = true;
 
-uint8_t osd_got_home = 0;               // tels if got home position or not
-double osd_home_lat = 0.0f;               // home latidude
-double osd_home_lon = 0.0f;               // home longitude
-float osd_home_alt = 0.0f;
 long osd_home_distance = 0;          // distance from home
 uint32_t osd_home_bearing = 0;
 uint8_t osd_alt_cnt = 0;              // counter for stable osd_alt
@@ -124,10 +111,6 @@ volatile uint8_t current_panel = 1;
 
 float atti_mp_scale = 0.0;
 float atti_3d_scale = 0.0;
-uint32_t atti_3d_min_clipX = 0;
-uint32_t atti_3d_max_clipX = 0;
-uint32_t atti_3d_min_clipY = 0;
-uint32_t atti_3d_max_clipY = 0;
 
 uint8_t got_mission_counts = 0;
 uint8_t enable_mission_count_request = 0;
@@ -142,5 +125,3 @@ WAYPOINT wp_list[MAX_WAYPOINTS];
 int8_t osd_offset_Y = 0;
 int8_t osd_offset_X = 0;
 
-osd_message_t osd_message_queue[OSD_MAX_MESSAGES];
-int osd_message_queue_tail = -1;
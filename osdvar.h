@@ -4,102 +4,180 @@
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #define WFB_LINK_LOST   1
 #define WFB_LINK_JAMMED 2
 
+#define OSD_MAX_MESSAGES 6
+
+typedef struct
+{
+    uint8_t severity;
+    char message[51];
+} osd_message_t;
+
+// Version of a state group, updated by the parser with every source message
+typedef struct
+{
+    uint64_t update_ms;                 // GetSystimeMS() of the last update, 0 if never updated
+    uint32_t changes;                   // incremented when an update changed the group
+} vs_version_t;
+
+typedef struct
+{
+    vs_version_t version;
+    double lat;                         // latidude
+    double lon;                         // longitude
+    double hdop;
+    uint8_t satellites_visible;         // number of satelites
+    uint8_t fix_type;                   // GPS lock 0-1=no fix, 2=2D, 3=3D
+} gps_state_t;
+
+/////////////////////////////////////////////////////////////////////////
+// Vehicle state decoded from MAVLink, grouped by source message.
+// Written only by the parser (vehicle_state) and published as a whole,
+// renderer reads a consistent snapshot (vs in osdrender.c).
+// Each group starts with its version.
+typedef struct
+{
+    struct
+    {
+        vs_version_t version;
+        uint8_t type;
+        uint8_t system;
+        uint8_t component;
+        uint8_t autopilot;
+        uint8_t base_mode;
+        uint32_t custom_mode;
+        bool motor_armed;
+        uint64_t armed_start_time;
+        uint64_t total_armed_time;
+    } heartbeat;
+
+    struct
+    {
+        vs_version_t version;
+        bool got_home;                  // tels if got home position or not
+        double lat;                     // home latidude
+        double lon;                     // home longitude
+        float alt;
+    } home;
+
+    struct
+    {
+        vs_version_t version;
+        uint8_t vtol_state;
+    } ext_sys_state;
+
+    struct
+    {
+        vs_version_t version;
+        float vbat;                     // Battery A voltage in volt
+        int16_t current;                // Battery A current, in 10*milliamperes
+        int8_t battery_remaining;       // 0 to 100
+    } sys_status;
+
+    struct
+    {
+        vs_version_t version;
+        uint32_t current_consumed;      // total current drawn since startup in mAh
+    } battery_status;
+
+    gps_state_t gps;
+    gps_state_t gps2;
+
+    struct
+    {
+        vs_version_t version;
+        float airspeed;
+        float groundspeed;
+        float heading;                  // 0..360 deg, 0=north
+        uint16_t throttle;
+        float alt;                      // altitude, also from GLOBAL_POSITION_INT
+        float climb;
+    } vfr_hud;
+
+    struct
+    {
+        vs_version_t version;
+        float rel_alt;                  // relative altitude, also from GLOBAL_POSITION_INT
+        float bottom_clearance;
+    } altitude;
+
+    struct
+    {
+        vs_version_t version;
+        float pitch;                    // deg
+        float roll;                     // deg
+        float yaw;                      // deg
+    } attitude;
+
+    struct
+    {
+        vs_version_t version;
+        float nav_roll;                 // Current desired roll in degrees
+        float nav_pitch;                // Current desired pitch in degrees
+        int16_t nav_bearing;            // Current desired heading in degrees
+        int16_t target_bearing;         // Bearing to current MISSION/target in degrees
+        uint16_t wp_dist;               // Distance to active MISSION in meters
+        float alt_error;                // Current altitude error in meters
+        float aspd_error;               // Current airspeed error in meters/second
+        float xtrack_error;             // Current crosstrack error on x-y plane in meters
+    } nav_controller;
+
+    struct
+    {
+        vs_version_t version;
+        uint8_t wp_number;              // Current waypoint number
+    } mission_current;
+
+    struct
+    {
+        vs_version_t version;
+        bool chan_cnt_above_eight;      // RC_CHANNELS seen, ignore RC_CHANNELS_RAW
+        uint16_t chan_raw[16];
+        uint8_t rssi;                   // raw value from mavlink
+    } rc_channels;
+
+    struct
+    {
+        vs_version_t version;
+        int8_t rssi;                    // WFB rssi, dBm
+        uint16_t errors;
+        uint16_t fec_fixed;
+        int8_t flags;                   // WFB_LINK_*
+    } radio_status;
+
+    struct
+    {
+        vs_version_t version;
+        osd_message_t queue[OSD_MAX_MESSAGES];
+        int tail;
+    } statustext;
+} vehicle_state_t;
+
+extern vehicle_state_t vehicle_state;
+
+void vehicle_state_touch(vs_version_t *version, const void *prev, const void *group, size_t size, uint64_t now_ms);
+void vehicle_state_publish(void);
+const vehicle_state_t *vehicle_state_snapshot(void);
+
 /////////////////////////////////////////////////////////////////////////
 extern uint64_t lastWritePanel;
-extern uint8_t mav_type;
-extern uint8_t mav_system;
-extern uint8_t mav_component;
 extern uint64_t sys_start_time;
-extern uint64_t armed_start_time;
-extern uint64_t total_armed_time;
-extern uint8_t vtol_state;
 
 /////////////////////////////////////////////////////////////////////////
-extern float osd_vbat_A;                 // Battery A voltage in milivolt
-extern int16_t osd_curr_A;                 // Battery A current
-extern int8_t osd_battery_remaining_A;    // 0 to 100 <=> 0 to 1000
-extern uint32_t osd_curr_consumed_mah; // total current drawn since startup in amp-hours
-
-extern float osd_pitch;                  // pitch from DCM
-extern float osd_roll;                   // roll from DCM
-extern float osd_yaw;                    // relative heading form DCM
-extern float osd_heading;                // ground course heading from GPS
-
-extern double osd_lat;                    // latidude
-extern double osd_lon;                    // longitude
-extern uint8_t osd_satellites_visible;     // number of satelites
-extern uint8_t osd_fix_type;               // GPS lock 0-1=no fix, 2=2D, 3=3D
-extern double osd_hdop;
-
-extern double osd_lat2;                    // latidude
-extern double osd_lon2;                    // longitude
-extern uint8_t osd_satellites_visible2;     // number of satelites
-extern uint8_t osd_fix_type2;               // GPS lock 0-1=no fix, 2=2D, 3=3D
-extern double osd_hdop2;
-
-extern float osd_airspeed;               // airspeed
-extern float osd_groundspeed;            // ground speed
 extern float osd_downVelocity;           // ground speed
-extern uint16_t osd_throttle;            // throtle
-extern float osd_alt;                    // altitude
-extern float osd_rel_alt;                // relative altitude	//  jmmods
-extern float osd_bottom_clearance;       // relative altitude	//  jmmods
-extern float osd_climb;
 extern float osd_climb_ma[10];
 extern int osd_climb_ma_index;
 extern float osd_total_trip_dist; //total trip distance since startup, calculated in meter
 
-extern float nav_roll; // Current desired roll in degrees
-extern float nav_pitch; // Current desired pitch in degrees
-extern int16_t nav_bearing; // Current desired heading in degrees
-extern int16_t wp_target_bearing; // Bearing to current MISSION/target in degrees
 extern int8_t wp_target_bearing_rotate_int;
-extern uint16_t wp_dist; // Distance to active MISSION in meters
-extern uint8_t wp_number; // Current waypoint number
-extern float alt_error; // Current altitude error in meters
-extern float aspd_error; // Current airspeed error in meters/second
-extern float xtrack_error; // Current crosstrack error on x-y plane in meters
 extern float eff; //Efficiency
 
-extern uint32_t custom_mode;
-extern bool motor_armed;
-extern bool last_motor_armed;
-extern uint8_t base_mode;
-extern uint8_t autopilot;
-
-extern bool osd_chan_cnt_above_eight;
-extern uint16_t osd_chan1_raw;
-extern uint16_t osd_chan2_raw;
-extern uint16_t osd_chan3_raw;
-extern uint16_t osd_chan4_raw;
-extern uint16_t osd_chan5_raw;
-extern uint16_t osd_chan6_raw;
-extern uint16_t osd_chan7_raw;
-extern uint16_t osd_chan8_raw;
-extern uint16_t osd_chan9_raw;
-extern uint16_t osd_chan10_raw;
-extern uint16_t osd_chan11_raw;
-extern uint16_t osd_chan12_raw;
-extern uint16_t osd_chan13_raw;
-extern uint16_t osd_chan14_raw;
-extern uint16_t osd_chan15_raw;
-extern uint16_t osd_chan16_raw;
-extern uint8_t osd_rssi; //raw value from mavlink
-
-extern int8_t wfb_rssi; //WFB rssi
-extern uint16_t wfb_errors;
-extern uint16_t wfb_fec_fixed;
-extern int8_t wfb_flags;
 extern bool rc_lost;
 
-extern uint8_t osd_got_home;               // tels if got home position or not
-extern double osd_home_lat;               // home latidude
-extern double osd_home_lon;               // home longitude
-extern float osd_home_alt;
 extern long osd_home_distance;          // distance from home
 extern uint32_t osd_home_bearing;
 extern uint8_t osd_alt_cnt;              // counter for stable osd_alt
@@ -112,10 +190,6 @@ extern volatile uint8_t current_panel;
 
 extern float atti_mp_scale;
 extern float atti_3d_scale;
-extern uint32_t atti_3d_min_clipX;
-extern uint32_t atti_3d_max_clipX;
-extern uint32_t atti_3d_min_clipY;
-extern uint32_t atti_3d_max_clipY;
 
 #define MAX_WAYPOINTS   20
 
@@ -148,17 +222,6 @@ typedef struct WAYPOINT_TYP {
 
 extern WAYPOINT wp_list[MAX_WAYPOINTS];
 
-#define OSD_MAX_MESSAGES 6
-
-typedef struct
-{
-    uint8_t severity;
-    char message[51];
-} osd_message_t;
-
-extern osd_message_t osd_message_queue[OSD_MAX_MESSAGES];
-extern int osd_message_queue_tail;
-
 extern int8_t osd_offset_Y;
 extern int8_t osd_offset_X;
 #endif